@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# Author of FLOAM: Wang Han
+# Email wh200720041@gmail.com
+# Homepage https://wanghan.pro
+
+# runs floam.launch on one bag with every solver_mode given and compares the trajectories
+# against the kitti ground truth, ATE / RPE and the odom estimation time of each frame
+#
+#   compare_solvers.py --bag 07.bag --sequence 07 --groundtruth poses/07.txt
+#   compare_solvers.py --skip-run --out /tmp/floam_solvers --sequence 07 --groundtruth poses/07.txt
+#
+# <out>/mode_<n>/<sequence>_pred.txt and <sequence>_time.txt are written by floam_odom_estimation_node
+# the bag is played at --rate with queue_policy 1 (block) so that no frame is dropped and line i is frame i
+
+import argparse
+import os
+import subprocess
+import sys
+
+import numpy as np
+
+
+def load_poses(path):
+    rows = np.loadtxt(path, ndmin=2)
+    if rows.shape[1] != 12:
+        sys.exit("%s: expected 12 values per line (kitti 3x4 pose), got %d" % (path, rows.shape[1]))
+    poses = np.tile(np.eye(4), (rows.shape[0], 1, 1))
+    poses[:, :3, :] = rows.reshape(-1, 3, 4)
+    return poses
+
+
+def umeyama(src, dst):
+    # rigid transform dst ~ R * src + t, no scale
+    mu_src = src.mean(axis=0)
+    mu_dst = dst.mean(axis=0)
+    cov = (dst - mu_dst).T @ (src - mu_src) / src.shape[0]
+    u, _, vt = np.linalg.svd(cov)
+    s = np.eye(3)
+    if np.linalg.det(u) * np.linalg.det(vt) < 0:
+        s[2, 2] = -1
+    r = u @ s @ vt
+    return r, mu_dst - r @ mu_src
+
+
+def ate(pred, gt):
+    r, t = umeyama(pred[:, :3, 3], gt[:, :3, 3])
+    aligned = pred[:, :3, 3] @ r.T + t
+    err = np.linalg.norm(aligned - gt[:, :3, 3], axis=1)
+    return np.sqrt(np.mean(err ** 2))
+
+
+def rpe(pred, gt, delta):
+    trans = []
+    rot = []
+    for i in range(len(pred) - delta):
+        d_pred = np.linalg.inv(pred[i]) @ pred[i + delta]
+        d_gt = np.linalg.inv(gt[i]) @ gt[i + delta]
+        e = np.linalg.inv(d_gt) @ d_pred
+        trans.append(np.linalg.norm(e[:3, 3]))
+        rot.append(np.degrees(np.arccos(np.clip((np.trace(e[:3, :3]) - 1.0) / 2.0, -1.0, 1.0))))
+    return np.sqrt(np.mean(np.square(trans))), np.sqrt(np.mean(np.square(rot)))
+
+
+def run(args, mode, out_dir):
+    os.makedirs(out_dir, exist_ok=True)
+    cmd = ["roslaunch", "floam", "floam.launch",
+           "bag:=" + args.bag,
+           "rate:=" + str(args.rate),
+           "sequence:=" + args.sequence,
+           "rviz:=false",
+           "solver_mode:=" + str(mode),
+           "output_dir:=" + out_dir,
+           "queue_policy:=1"]
+    print(" ".join(cmd))
+    #rosbag_play is required, roslaunch returns when the bag is done
+    subprocess.run(cmd, check=False)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="compare the odometry solver modes on one bag")
+    parser.add_argument("--bag", help="kitti bag played by floam.launch")
+    parser.add_argument("--sequence", default="07")
+    parser.add_argument("--groundtruth", required=True, help="kitti poses of the sequence, e.g. poses/07.txt")
+    parser.add_argument("--modes", type=int, nargs="+", default=[0, 2], help="solver_mode values, the first is the reference")
+    parser.add_argument("--rate", type=float, default=0.5, help="rosbag play rate")
+    parser.add_argument("--delta", type=int, default=10, help="RPE frame distance")
+    parser.add_argument("--out", default="/tmp/floam_solvers")
+    parser.add_argument("--skip-run", action="store_true", help="only evaluate the files already in --out")
+    args = parser.parse_args()
+    if not args.skip_run and args.bag is None:
+        parser.error("--bag is needed unless --skip-run is given")
+
+    gt_all = load_poses(args.groundtruth)
+    results = []
+    for mode in args.modes:
+        out_dir = os.path.join(os.path.abspath(args.out), "mode_%d" % mode)
+        if not args.skip_run:
+            run(args, mode, out_dir)
+        pred = load_poses(os.path.join(out_dir, args.sequence + "_pred.txt"))
+        times = np.loadtxt(os.path.join(out_dir, args.sequence + "_time.txt"), ndmin=1)
+        n = min(len(pred), len(gt_all))
+        if len(pred) != len(gt_all):
+            print("mode %d: %d poses for %d ground truth frames, frames were dropped or the bag is cut, comparing the first %d"
+                  % (mode, len(pred), len(gt_all), n))
+        gt = gt_all[:n]
+        pred = pred[:n]
+        rpe_t, rpe_r = rpe(pred, gt, args.delta)
+        #the first frame only builds the map and is written as 0 ms
+        t = times[1:] if len(times) > 1 else times
+        results.append((mode, n, ate(pred, gt), rpe_t, rpe_r, t))
+
+    print("")
+    print("%-5s %7s %9s %11s %13s %10s %10s %10s %10s"
+          % ("mode", "frames", "ATE[m]", "RPE_t[m]", "RPE_r[deg]", "mean[ms]", "median[ms]", "p95[ms]", "max[ms]"))
+    for mode, n, ate_rmse, rpe_t, rpe_r, t in results:
+        print("%-5d %7d %9.4f %11.4f %13.4f %10.2f %10.2f %10.2f %10.2f"
+              % (mode, n, ate_rmse, rpe_t, rpe_r, np.mean(t), np.median(t), np.percentile(t, 95), np.max(t)))
+    ref = results[0]
+    for mode, n, ate_rmse, rpe_t, rpe_r, t in results[1:]:
+        print("mode %d vs %d: ATE %+.4f m, RPE_t %+.4f m, RPE_r %+.4f deg, %.2fx faster per frame"
+              % (mode, ref[0], ate_rmse - ref[2], rpe_t - ref[3], rpe_r - ref[4], np.mean(ref[5]) / np.mean(t)))
+
+
+if __name__ == "__main__":
+    main()
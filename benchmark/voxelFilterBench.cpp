@@ -0,0 +1,123 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+//micro-benchmark of VoxelHashFilter against pcl::VoxelGrid on recorded frames
+//usage: floam_voxel_bench <leaf_size> <frame.pcd | kitti_velodyne.bin> ...
+//prints the time of both filters per frame and fails if the centroids differ
+
+//c++ lib
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <chrono>
+
+//PCL
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/voxel_grid.h>
+
+//LOCAL LIB
+#include "voxelHashFilter.h"
+
+typedef std::chrono::steady_clock BenchClock;
+
+//pcl::VoxelGrid sums in float, VoxelHashFilter in double
+const float centroid_tolerance = 1e-4;
+const int repeat_count = 20;
+
+bool loadFrame(const std::string& file_name, pcl::PointCloud<pcl::PointXYZI>& cloud)
+{
+    if(file_name.size() > 4 && file_name.compare(file_name.size() - 4, 4, ".bin") == 0){
+        //kitti velodyne scan: x, y, z, reflectance as float32
+        FILE* file = fopen(file_name.c_str(), "rb");
+        if(file == NULL)
+            return false;
+        float data[4];
+        cloud.clear();
+        while(fread(data, sizeof(float), 4, file) == 4){
+            pcl::PointXYZI point;
+            point.x = data[0];
+            point.y = data[1];
+            point.z = data[2];
+            point.intensity = data[3];
+            cloud.push_back(point);
+        }
+        fclose(file);
+        return true;
+    }
+    return pcl::io::loadPCDFile<pcl::PointXYZI>(file_name, cloud) == 0;
+}
+
+bool sameCentroids(const pcl::PointCloud<pcl::PointXYZI>& expected, const pcl::PointCloud<pcl::PointXYZI>& result)
+{
+    if(expected.points.size() != result.points.size()){
+        printf("  voxel count differs: pcl %d, hash %d\n", (int)expected.points.size(), (int)result.points.size());
+        return false;
+    }
+    //same order as pcl::VoxelGrid, compared point by point
+    for(size_t i = 0; i < expected.points.size(); i++){
+        const pcl::PointXYZI& a = expected.points[i];
+        const pcl::PointXYZI& b = result.points[i];
+        if(std::fabs(a.x - b.x) > centroid_tolerance || std::fabs(a.y - b.y) > centroid_tolerance
+                || std::fabs(a.z - b.z) > centroid_tolerance || std::fabs(a.intensity - b.intensity) > centroid_tolerance){
+            printf("  centroid %d differs: pcl (%f %f %f %f), hash (%f %f %f %f)\n", (int)i,
+                   a.x, a.y, a.z, a.intensity, b.x, b.y, b.z, b.intensity);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 3){
+        printf("usage: %s <leaf_size> <frame.pcd | kitti_velodyne.bin> ...\n", argv[0]);
+        return 2;
+    }
+    float leaf_size = atof(argv[1]);
+
+    pcl::VoxelGrid<pcl::PointXYZI> voxelGrid;
+    VoxelHashFilter voxelHash;
+    voxelGrid.setLeafSize(leaf_size, leaf_size, leaf_size);
+    voxelHash.setLeafSize(leaf_size, leaf_size, leaf_size);
+
+    double total_grid_ms = 0;
+    double total_hash_ms = 0;
+    int failed = 0;
+    for(int i = 2; i < argc; i++){
+        pcl::PointCloud<pcl::PointXYZI>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZI>());
+        if(!loadFrame(argv[i], *cloud)){
+            printf("%s: cannot read\n", argv[i]);
+            failed++;
+            continue;
+        }
+
+        pcl::PointCloud<pcl::PointXYZI> grid_out;
+        pcl::PointCloud<pcl::PointXYZI> hash_out;
+        voxelGrid.setInputCloud(cloud);
+        voxelHash.setInputCloud(cloud);
+
+        BenchClock::time_point start = BenchClock::now();
+        for(int j = 0; j < repeat_count; j++)
+            voxelGrid.filter(grid_out);
+        double grid_ms = std::chrono::duration<double, std::milli>(BenchClock::now() - start).count() / repeat_count;
+
+        start = BenchClock::now();
+        for(int j = 0; j < repeat_count; j++)
+            voxelHash.filter(hash_out);
+        double hash_ms = std::chrono::duration<double, std::milli>(BenchClock::now() - start).count() / repeat_count;
+
+        bool same = sameCentroids(grid_out, hash_out);
+        if(!same)
+            failed++;
+        total_grid_ms += grid_ms;
+        total_hash_ms += hash_ms;
+        printf("%s: %d points -> %d voxels, VoxelGrid %.3f ms, VoxelHashFilter %.3f ms, %s\n", argv[i],
+               (int)cloud->points.size(), (int)hash_out.points.size(), grid_ms, hash_ms, same ? "same" : "DIFFERENT");
+    }
+    printf("total: VoxelGrid %.3f ms, VoxelHashFilter %.3f ms, %d frame(s) failed\n", total_grid_ms, total_hash_ms, failed);
+    return failed == 0 ? 0 : 1;
+}
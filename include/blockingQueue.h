@@ -0,0 +1,124 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _BLOCKING_QUEUE_H_
+#define _BLOCKING_QUEUE_H_
+
+//c++ lib
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+#include <utility>
+
+//what push does when the queue is full
+enum QueuePolicy{
+    QUEUE_DROP_OLDEST = 0,     //drop the front item and queue the new one
+    QUEUE_BLOCK = 1,           //wait until the consumer took an item
+    QUEUE_KEEP_LATEST = 2,     //drop everything queued and keep only the new item (jump to the latest frame)
+    QUEUE_SKIP = 3             //drop the new item, the queued ones are processed first
+};
+
+//bounded multi-producer queue between the ros callbacks and the worker thread of a node
+//pop sleeps until an item is pushed instead of polling, every item keeps the time it was queued
+template <typename T>
+class BlockingQueue
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        BlockingQueue(){
+            capacity = 100;
+            policy = QUEUE_DROP_OLDEST;
+            dropped_count = 0;
+            closed = false;
+        }
+
+        //capacity 0 is taken as 1
+        void setCapacity(size_t capacity_in, QueuePolicy policy_in){
+            std::lock_guard<std::mutex> lock(mutex);
+            capacity = capacity_in > 0 ? capacity_in : 1;
+            policy = policy_in;
+        }
+
+        //returns false if the queue was closed, an item dropped by the policy still returns true
+        bool push(const T& item){
+            std::unique_lock<std::mutex> lock(mutex);
+            if(policy == QUEUE_BLOCK){
+                not_full.wait(lock, [this]{ return closed || items.size() < capacity; });
+            }else if(items.size() >= capacity){
+                if(policy == QUEUE_SKIP){
+                    dropped_count++;
+                    return !closed;
+                }
+                size_t drop = policy == QUEUE_KEEP_LATEST ? items.size() : items.size() - capacity + 1;
+                items.erase(items.begin(), items.begin() + drop);
+                dropped_count += drop;
+            }
+            if(closed)
+                return false;
+            items.push_back(std::make_pair(item, Clock::now()));
+            lock.unlock();
+            not_empty.notify_one();
+            return true;
+        }
+
+        //blocks while the queue is empty, returns false once it is closed and drained
+        bool pop(T& item, Clock::time_point& enqueued){
+            std::unique_lock<std::mutex> lock(mutex);
+            not_empty.wait(lock, [this]{ return closed || !items.empty(); });
+            if(items.empty())
+                return false;
+            item = std::move(items.front().first);
+            enqueued = items.front().second;
+            items.pop_front();
+            lock.unlock();
+            not_full.notify_one();
+            return true;
+        }
+
+        //wake every waiting thread, push fails from now on and pop drains what is left
+        void close(){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+            not_empty.notify_all();
+            not_full.notify_all();
+        }
+
+        size_t size() const{
+            std::lock_guard<std::mutex> lock(mutex);
+            return items.size();
+        }
+
+        size_t maxSize() const{
+            std::lock_guard<std::mutex> lock(mutex);
+            return capacity;
+        }
+
+        QueuePolicy queuePolicy() const{
+            std::lock_guard<std::mutex> lock(mutex);
+            return policy;
+        }
+
+        //items dropped by the policy since the start, new ones included
+        unsigned long dropped() const{
+            std::lock_guard<std::mutex> lock(mutex);
+            return dropped_count;
+        }
+
+    private:
+        std::deque<std::pair<T, Clock::time_point>> items;
+        size_t capacity;
+        QueuePolicy policy;
+        unsigned long dropped_count;
+        bool closed;
+        mutable std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+};
+
+#endif // _BLOCKING_QUEUE_H_
+
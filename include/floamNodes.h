@@ -0,0 +1,66 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _FLOAM_NODES_H_
+#define _FLOAM_NODES_H_
+
+//ros lib
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Image.h>
+#include <nav_msgs/Odometry.h>
+
+//eigen lib
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+//LOCAL LIB
+#include "pointCloud2View.h"
+
+//entry points of the three stages, shared by the standalone nodes, the nodelets and the pipeline node
+//setup() reads the parameters, subscribes, advertises and starts the worker thread of the stage,
+//false if the stage was already set up in this process (its state is namespace-global)
+//shutdown() closes the input queues of the stage and joins its worker
+//init/processFrame/publish are the same stage without its own subscribers and thread
+namespace laser_processing_node{
+//messages of one processed frame, the same ones the stage publishes
+class ProcessedFrame{
+    public:
+        sensor_msgs::PointCloud2Ptr edge;
+        sensor_msgs::PointCloud2Ptr surf;
+        sensor_msgs::PointCloud2Ptr filtered;     //edge + surf, input of the mapping
+        sensor_msgs::ImageConstPtr image;
+        sensor_msgs::ImagePtr debug_image;        //edge points drawn on the camera image, only with /debug_visualization
+};
+
+bool setup(ros::NodeHandle& nh);
+void shutdown();
+void init(ros::NodeHandle& nh);
+void advertise(ros::NodeHandle& nh);
+void processFrame(const sensor_msgs::PointCloud2ConstPtr& pointcloud_msg, const sensor_msgs::ImageConstPtr& image_msg, ProcessedFrame& frame);
+void publish(const ProcessedFrame& frame);
+}
+
+namespace odom_estimation_node{
+bool setup(ros::NodeHandle& nh);
+void shutdown();
+void init(ros::NodeHandle& nh);
+void advertise(ros::NodeHandle& nh);
+nav_msgs::OdometryPtr processFrame(const PointCloud2View& pointcloud_edge_in, const PointCloud2View& pointcloud_surf_in,
+                                   const sensor_msgs::ImageConstPtr& imageMsg, const ros::Time& pointcloud_time);
+//odometry message and map -> base_link tf
+void publish(const nav_msgs::OdometryPtr& laserOdometry);
+}
+
+namespace laser_mapping_node{
+bool setup(ros::NodeHandle& nh);
+void shutdown();
+void init(ros::NodeHandle& nh);
+void advertise(ros::NodeHandle& nh);
+sensor_msgs::PointCloud2Ptr processFrame(const PointCloud2View& pointcloud_in, const Eigen::Isometry3d& current_pose, const ros::Time& pointcloud_time);
+void publish(const sensor_msgs::PointCloud2Ptr& PointsMsg);
+Eigen::Isometry3d poseFromOdometry(const nav_msgs::Odometry& odometry);
+}
+
+#endif // _FLOAM_NODES_H_
+
@@ -0,0 +1,38 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _FRAME_IMAGE_CONTEXT_H_
+#define _FRAME_IMAGE_CONTEXT_H_
+
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+#include <cv_bridge/cv_bridge.h>
+#include <opencv2/opencv.hpp>
+
+//camera image of one lidar frame, every version is made on first use and then shared
+class FrameImageContext
+{
+    public:
+        FrameImageContext(const sensor_msgs::ImageConstPtr& image_msg_in, bool debug_in);
+
+        //BGR8 image, shares the message buffer when the encoding already is bgr8
+        const cv::Mat& bgr();
+        const cv::Mat& gray();
+        //gray after a 3x3 Gaussian blur (sigma 1)
+        const cv::Mat& blurred();
+        //writable copy for drawing, only valid when debug visualization is on
+        cv::Mat& debugImage();
+        bool debug() const;
+
+    private:
+        sensor_msgs::ImageConstPtr image_msg;
+        cv_bridge::CvImageConstPtr bgr_ptr;
+        cv_bridge::CvImageConstPtr mono_ptr;
+        cv_bridge::CvImagePtr debug_ptr;
+        cv::Mat gray_image;
+        cv::Mat blurred_image;
+        bool debug_enabled;
+};
+
+#endif // _FRAME_IMAGE_CONTEXT_H_
+
@@ -0,0 +1,74 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _IKD_TREE_H_
+#define _IKD_TREE_H_
+
+//c++ lib
+#include <vector>
+
+//PCL
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+//eigen
+#include <Eigen/Dense>
+
+//incremental kd-tree for the local map of the odometry (ikd-tree style)
+//points are inserted into the existing tree, deleting a box only marks the nodes and
+//a subtree is rebuilt when it gets unbalanced or mostly deleted, so the whole tree is never rebuilt per frame
+class IkdTree
+{
+    public:
+        IkdTree();
+        //a point is not inserted if its voxel of this size already holds a point, 0 keeps every point
+        void setDownsampleResolution(float resolution_in);
+        void addPoints(const pcl::PointCloud<pcl::PointXYZI>& points_in);
+        //delete every point outside [box_min, box_max]
+        void cropToBox(const Eigen::Vector3f& box_min, const Eigen::Vector3f& box_max);
+        void clear();
+        //number of points not deleted
+        int size() const;
+        //k nearest points sorted by increasing distance, fewer if the tree holds less than k points
+        //const and read-only, may run from several threads as long as the tree is not modified
+        void nearestKSearch(const pcl::PointXYZI& point, int k, std::vector<pcl::PointXYZI>& near_points, std::vector<float>& sq_dis) const;
+        void getPoints(pcl::PointCloud<pcl::PointXYZI>& points_out) const;
+
+    private:
+        struct Node{
+            pcl::PointXYZI point;
+            int axis;
+            int left;
+            int right;
+            int tree_size;          //nodes of the subtree, deleted ones included
+            int invalid_size;       //deleted nodes of the subtree
+            bool deleted;
+            bool tree_deleted;      //whole subtree deleted, not pushed down to the children yet
+            float box_min[3];       //bounding box of the subtree
+            float box_max[3];
+        };
+        typedef std::vector<pcl::PointXYZI, Eigen::aligned_allocator<pcl::PointXYZI>> PointVector;
+
+        std::vector<Node> nodes;
+        std::vector<int> free_nodes;
+        int root;
+        float resolution;
+        PointVector rebuild_points;
+
+        int newNode(const pcl::PointXYZI& point);
+        int build(PointVector& points, int begin, int end);
+        int rebuild(int node, const pcl::PointXYZI* extra_point);
+        void collect(int node, bool tree_deleted, PointVector& points);
+        int insert(int node, const pcl::PointXYZI& point);
+        int crop(int node, const float box_min[3], const float box_max[3]);
+        void markTreeDeleted(int node);
+        void pushDown(int node);
+        void update(int node);
+        bool needRebuild(int node) const;
+        bool hasPointInBox(int node, const float box_min[3], const float box_max[3]) const;
+        void search(int node, const pcl::PointXYZI& point, int k, std::vector<std::pair<float, int>>& heap) const;
+        void getPoints(int node, pcl::PointCloud<pcl::PointXYZI>& points_out) const;
+};
+
+#endif // _IKD_TREE_H_
+
@@ -22,6 +22,9 @@
 #include <math.h>
 #include <vector>
 
+//LOCAL LIB
+#include "pointCloud2View.h"
+
 
 #define LASER_CELL_WIDTH 50.0
 #define LASER_CELL_HEIGHT 50.0
@@ -40,6 +43,7 @@ class LaserMappingClass
     	LaserMappingClass();
 		void init(double map_resolution);
 		void updateCurrentPointsToMap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, const Eigen::Isometry3d& pose_current);
+		void updateCurrentPointsToMap(const PointCloud2View& pc_in, const Eigen::Isometry3d& pose_current);
 		pcl::PointCloud<pcl::PointXYZI>::Ptr getMap(void);
 
 	private:
@@ -59,6 +63,7 @@ class LaserMappingClass
 		void addDepthCellNegative(void);
 		void addDepthCellPositive(void);
 		void checkPoints(int& x, int& y, int& z);
+		void filterCellsAround(int x, int y, int z);
 
 };
 
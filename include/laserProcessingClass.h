@@ -14,6 +14,10 @@
 #include <pcl/filters/crop_box.h>
 
 #include "lidar.h"
+#include "threadPool.h"
+#include "frameImageContext.h"
+#include "voxelHashFilter.h"
+#include "rangeImage.h"
 
 #include <sensor_msgs/Image.h>
 
@@ -38,29 +42,77 @@ public:
 	PointsInfo(int layer_in, double time_in);
 };
 
+//image projection of the feature points of one frame, edge points first and surf points after them
+class ScanProjection{
+public:
+	std::vector<int> u;
+	std::vector<int> v;
+	std::vector<double> depth;
+	std::vector<unsigned char> valid;	//in front of the lidar and inside the image
+	int edge_count;
+	int surf_count;
+};
+
+//SoA copy of one scan line, reused by the curvature kernel
+class ScanCurvatureBuffer{
+public:
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+};
+
+//plane pixel classifier used by pointcloudtodepth
+enum PlaneDetectMode{
+	PLANE_DETECT_SCALAR = 0,	//per pixel window scan
+	PLANE_DETECT_SIMD = 1,		//whole rows with SSE2/AVX2, same output as scalar
+	PLANE_DETECT_SEPARABLE = 2,	//precomputed running window min/max, cost independent of window_size
+	PLANE_DETECT_SPARSE = 3		//only the pixels hit by a projected point, cost follows the point count
+};
 
 class LaserProcessingClass 
 {
     public:
     	LaserProcessingClass();
-		void init(lidar::Lidar lidar_param_in);
+		void init(lidar::Lidar lidar_param_in, int num_threads);
+		void setPlaneDetectMode(int mode_in);
+		//lidar parameters with the ring table built by init
+		const lidar::Lidar& lidarParam() const;
+		//camera intrinsics/extrinsics used to lift plane pixels back to lidar points, call once before the first frame
+		void setCameraCalibration(const Eigen::Matrix3d& result, const Eigen::Matrix3d& RR, const Eigen::Vector3d& tt);
+		//point_rings: ring of every point of pc_in from the driver, empty to compute it from the elevation
 		void featureExtraction( pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, 
+								const std::vector<int>& point_rings,
 								pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_edge, 
 								pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_first,
-								sensor_msgs::ImageConstPtr& image_msg, 
-                                Eigen::Matrix<double, 3, 4>& matrix_3Dto2D);
+								FrameImageContext& image, 
+                                Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
+								ScanProjection& projection);
+		//same feature extraction with the scan lines taken from the rows of an organized range image
+		void featureExtraction( const RangeImage& range_image,
+								pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_edge, 
+								pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_first,
+								FrameImageContext& image, 
+                                Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
+								ScanProjection& projection);
+		void projectScan(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in,
+						 const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in,
+						 const Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
+						 int cols, int rows,
+						 ScanProjection& projection);
+		void computeCurvature(const pcl::PointCloud<pcl::PointXYZI>::Ptr& scan_in,
+							  ScanCurvatureBuffer& buffer,
+							  std::vector<Double2d>& cloudCurvature);
 		void featureExtractionFromSector(const pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, 
 											   std::vector<Double2d>& cloudCurvature, 
+											   int sector_start, int sector_end,
 											   pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_edge,
 											   pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_surf
 											   );	
 		void pointcloudtodepth(pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in,
-                       sensor_msgs::ImageConstPtr& image_msg, 
+                       FrameImageContext& image, 
                        Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
-                       Eigen::Matrix3d& result,
-                       Eigen::Matrix3d& RR,
-                       Eigen::Vector3d& tt,
 					   pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_first,
+					   const ScanProjection& projection,
                        pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_surf
                        );
 		void planeDetect(sensor_msgs::ImageConstPtr& image_msg, int windowSize, cv::Mat& depthImage, std::vector<cv::Point>& planePixels);
@@ -68,7 +120,41 @@ class LaserProcessingClass
 		void downSamplingToMap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_pc_in, pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_pc_out);
 	private:
      	lidar::Lidar lidar_param;
-		pcl::VoxelGrid<pcl::PointXYZI> downSizeFilterSurf;
+		int plane_detect_mode;
+		VoxelHashFilter downSizeFilterSurf;
+
+		//workers for the per scan feature extraction and the plane pixel search, created once in init
+		std::unique_ptr<ThreadPool> threadPool;
+		//plane pixels of each row band, reused across frames
+		std::vector<std::vector<cv::Point>> planePixelBands;
+		//running window min/max images of PLANE_DETECT_SEPARABLE
+		cv::Mat windowMinX, windowMaxX, windowMinY, windowMaxY;
+		//PLANE_DETECT_SPARSE: depth images kept zero between frames and the pixels hit this frame
+		cv::Mat sparseDepthImage, sparseDepthStore;
+		std::vector<int> hitPixels;
+		//points of every scan line, reused across frames
+		std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> laserCloudScans;
+		void prepareScans(int N_SCANS);
+		void featureExtractionFromScans(pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_edge, 
+										pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_first,
+										FrameImageContext& image, 
+										Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
+										ScanProjection& projection);
+		//scan line of every input point, -1 if dropped
+		std::vector<int> pointRings;
+		//per scan line curvature scratch and feature output of featureExtraction, merged in scan order
+		std::vector<ScanCurvatureBuffer> ringCurvatureBuffers;
+		std::vector<std::vector<Double2d>> ringCurvature;
+		std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> ringEdge;
+		std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> ringSurf;
+		//homogeneous points and their image coordinates of projectScan
+		Eigen::Matrix<double, 4, Eigen::Dynamic> projectionPoints;
+		Eigen::Matrix<double, 3, Eigen::Dynamic> projectionImage;
+		//pixel (x*d, y*d, d) -> lidar point is backProjectionMatrix * pixel - backProjectionOffset
+		Eigen::Matrix3d backProjectionMatrix;
+		Eigen::Vector3d backProjectionOffset;
+		Eigen::Matrix<double, 3, Eigen::Dynamic> backProjectionPixels;
+		Eigen::Matrix<double, 3, Eigen::Dynamic> backProjectionPoints;
 };
 
 
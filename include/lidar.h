@@ -6,6 +6,9 @@
 
 //define lidar parameter
 
+#include <vector>
+#include <cmath>
+
 namespace lidar{
 
 class Lidar
@@ -21,6 +24,14 @@ class Lidar
         void setMaxDistance(double max_distance_in);
         void setMinDistance(double min_distance_in);
 
+        //elevation -> ring lookup table of the model given by num_lines (16, 32, 64 or evenly spaced
+        //rings from vertical_angle down by vertical_angle_resolution), call after the setters
+        void buildRingTable();
+        //ring of a point with tan(elevation) = tan_angle, -1 if it belongs to no ring
+        int ringFromTan(double tan_angle) const;
+        //exact ring of an elevation in degrees, what the table is built from
+        int ringFromAngle(double angle) const;
+
     	double max_distance;
         double min_distance;
         int num_lines;
@@ -30,8 +41,23 @@ class Lidar
         double horizontal_angle;
         double vertical_angle_resolution;
         double vertical_angle;
+
+        //ring of each cell of tan(elevation), -2 if a ring border falls inside the cell
+        std::vector<short> ring_table;
+        double ring_table_min;
+        double ring_table_inverse_step;
 };
 
+//table lookup, the exact angle math only runs for cells that contain a ring border
+inline int Lidar::ringFromTan(double tan_angle) const{
+    double cell = (tan_angle - ring_table_min) * ring_table_inverse_step;
+    if (!(cell >= 0 && cell < (double)ring_table.size()))
+        return ring_table.empty() ? ringFromAngle(std::atan(tan_angle) * 180 / M_PI) : -1;
+    int ring = ring_table[(int)cell];
+    if (ring == -2)
+        ring = ringFromAngle(std::atan(tan_angle) * 180 / M_PI);
+    return ring;
+}
 
 }
 
@@ -18,6 +18,13 @@ void getTransformFromSe3(const Eigen::Matrix<double,6,1>& se3, Eigen::Quaternion
 
 Eigen::Matrix3d skew(Eigen::Vector3d& mat_in);
 
+//residual of a point against a line (edge) or a plane (surf) at pose q, t and its jacobian w.r.t. the se3 update of PoseSE3Parameterization
+//shared by the ceres cost functions below and the gauss-newton solver of the odometry, jacobian may be NULL
+double edgeResidual(const Eigen::Quaterniond& q, const Eigen::Vector3d& t, const Eigen::Vector3d& curr_point,
+                    const Eigen::Vector3d& point_a, const Eigen::Vector3d& point_b, Eigen::Matrix<double, 1, 6>* jacobian);
+double surfResidual(const Eigen::Quaterniond& q, const Eigen::Vector3d& t, const Eigen::Vector3d& curr_point,
+                    const Eigen::Vector3d& plane_unit_norm, double negative_OA_dot_norm, Eigen::Matrix<double, 1, 6>* jacobian);
+
 class EdgeAnalyticCostFunction : public ceres::SizedCostFunction<1, 7> {
 	public:
 
@@ -8,6 +8,7 @@
 #include <string>
 #include <math.h>
 #include <vector>
+#include <memory>
 
 //PCL
 #include <pcl/point_cloud.h>
@@ -31,6 +32,11 @@
 //LOCAL LIB
 #include "lidar.h"
 #include "lidarOptimization.h"
+#include "voxelHashFilter.h"
+#include "pointCloud2View.h"
+#include "ikdTree.h"
+#include "voxelHashMap.h"
+#include "threadPool.h"
 #include <ros/ros.h>
 
 #include <sensor_msgs/Image.h>
@@ -44,16 +50,73 @@ struct Residualcoordinate{
     std::vector<cv::Point3d> corres_3d;
 };
 
+//structure of the local edge/surf maps used for the nearest neighbor search
+enum MapBackend{
+	MAP_BACKEND_FLANN = 0,		//point clouds, cropped and downsampled every frame, KdTreeFLANN rebuilt every frame
+	MAP_BACKEND_IKD_TREE = 1,	//incremental kd-trees, only the new points are inserted
+	MAP_BACKEND_VOXEL_HASH = 2	//hashed 1 m voxels, neighbors from the 27 voxels around the point
+};
+
+//how the pose of a frame is optimized
+enum SolverMode{
+	SOLVER_CERES = 0,			//new ceres problem and new correspondences for every iteration
+	SOLVER_CERES_REUSE = 1,		//one ceres problem per frame with pooled cost functions, only the points that moved are searched again
+	SOLVER_GAUSS_NEWTON = 2		//6x6 normal equations built on the thread pool, same residuals, huber weights and se3 update as ceres
+};
+
+//line found for one edge point, written by the parallel search and read by the serial ceres phase
+class EdgeCorrespondence{
+    public:
+        bool valid;
+        bool updated;       //searched again in the last findCorrespondences
+        bool fit_error;     //debug: the least-squares line disagrees with the PCA line
+        Eigen::Vector3d associated_point;  //point in the map frame at the last search
+        Eigen::Vector3d curr_point;
+        Eigen::Vector3d point_a;
+        Eigen::Vector3d point_b;
+};
+
+//plane found for one surf point
+class SurfCorrespondence{
+    public:
+        bool valid;
+        bool updated;
+        bool fit_error;     //debug: the PCA normal disagrees with the QR normal
+        Eigen::Vector3d associated_point;
+        Eigen::Vector3d curr_point;
+        Eigen::Vector3d norm;
+        double negative_OA_dot_norm;
+};
+
+//partial sums of the gauss-newton normal equations of one block of correspondences
+class NormalEquation{
+    public:
+        Eigen::Matrix<double, 6, 6> H;
+        Eigen::Matrix<double, 6, 1> g;
+        double cost;
+        int residual_num;
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
 class OdomEstimationClass 
 {
 
     public:
     	OdomEstimationClass();
     	
-		void init(lidar::Lidar lidar_param, double map_resolution);	
+		//num_threads <= 0 means hardware concurrency
+		void init(lidar::Lidar lidar_param, double map_resolution, int num_threads);	
+		void setMapBackend(int backend_in);
+		void setSolverMode(int mode_in);
+		//SOLVER_CERES_REUSE: a point is searched again once it moved more than this (m) since its last search
+		void setReassociationThreshold(double threshold_in);
 		void initMapWithPoints(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in);
 		void updatePointsToMap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in, 
 							   const sensor_msgs::ImageConstPtr& image_in, const int sequence_number);
+		//same as above, reading the edge/surf points straight from the messages
+		void initMapWithPoints(const PointCloud2View& edge_in, const PointCloud2View& surf_in);
+		void updatePointsToMap(const PointCloud2View& edge_in, const PointCloud2View& surf_in, 
+							   const sensor_msgs::ImageConstPtr& image_in, const int sequence_number);
 		void getMap(pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudMap);
 
 		Eigen::Isometry3d odom;
@@ -73,9 +136,16 @@ class OdomEstimationClass
 		pcl::KdTreeFLANN<pcl::PointXYZI>::Ptr kdtreeEdgeMap;
 		pcl::KdTreeFLANN<pcl::PointXYZI>::Ptr kdtreeSurfMap;
 
+		//MAP_BACKEND_IKD_TREE/VOXEL_HASH: the local map lives in these, laserCloudCornerMap/SurfMap stay empty
+		int map_backend;
+		IkdTree ikdtreeEdgeMap;
+		IkdTree ikdtreeSurfMap;
+		VoxelHashMap voxelMapEdge;
+		VoxelHashMap voxelMapSurf;
+
 		//points downsampling before add to map
-		pcl::VoxelGrid<pcl::PointXYZI> downSizeFilterEdge;
-		pcl::VoxelGrid<pcl::PointXYZI> downSizeFilterSurf;
+		VoxelHashFilter downSizeFilterEdge;
+		VoxelHashFilter downSizeFilterSurf;
 
 		//local map
 		pcl::CropBox<pcl::PointXYZI> cropBoxFilter;
@@ -83,11 +153,47 @@ class OdomEstimationClass
 		//optimization count 
 		int optimization_count;
 
+		//correspondence search, one slot per downsampled point, kept between frames to reuse the memory
+		std::unique_ptr<ThreadPool> threadPool;
+		std::vector<EdgeCorrespondence> edgeCorrespondences;
+		std::vector<SurfCorrespondence> surfCorrespondences;
+
+		//SOLVER_CERES_REUSE: cost functions of the slots, allocated once and owned here, the problem only lives for one frame
+		int solver_mode;
+		double reassociation_threshold;
+		std::vector<std::unique_ptr<EdgeAnalyticCostFunction>> edgeCostFunctions;
+		std::vector<std::unique_ptr<SurfNormAnalyticCostFunction>> surfCostFunctions;
+		std::vector<ceres::ResidualBlockId> edgeResidualIds;
+		std::vector<ceres::ResidualBlockId> surfResidualIds;
+		std::unique_ptr<ceres::LossFunction> huberLoss;
+		//SOLVER_GAUSS_NEWTON: one entry per block of correspondences, summed after the parallel phase
+		std::vector<NormalEquation, Eigen::aligned_allocator<NormalEquation>> normalEquations;
+
 		//function
-		void addEdgeCostFactor(const pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& map_in, ceres::Problem& problem, ceres::LossFunction *loss_function);
-		void addSurfCostFactor(const pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& map_in, ceres::Problem& problem, ceres::LossFunction *loss_function);
+		//parallel phase: edge and surf points are searched together on the thread pool, nothing is added to ceres
+		//a slot is kept if its point moved less than reassociation_threshold_in since its last search, < 0 searches every point
+		void findCorrespondences(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in, double reassociation_threshold_in);
+		void findEdgeCorrespondence(const pcl::PointXYZI& point_in, double reassociation_threshold_in, EdgeCorrespondence& result) const;
+		void findSurfCorrespondence(const pcl::PointXYZI& point_in, double reassociation_threshold_in, SurfCorrespondence& result) const;
+		//serial phase: residual blocks from the valid correspondences
+		void addEdgeCostFactor(ceres::Problem& problem, ceres::LossFunction *loss_function);
+		void addSurfCostFactor(ceres::Problem& problem, ceres::LossFunction *loss_function);
+		//SOLVER_CERES_REUSE: update, add or remove the residual blocks of the slots searched again
+		void updateEdgeResiduals(ceres::Problem& problem);
+		void updateSurfResiduals(ceres::Problem& problem);
+		void solveCeres(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in);
+		void solveCeresReuse(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in);
+		void solveGaussNewton(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in);
+		//normal equations of the valid correspondences at the current pose, cost_only leaves H and g zero
+		void buildNormalEquation(NormalEquation& total, bool cost_only);
+		//5 nearest points of the local map in the selected backend, sorted by distance
+		//read-only, called from the thread pool
+		void searchEdgeMap(const pcl::PointXYZI& point, std::vector<pcl::PointXYZI>& near_points, std::vector<float>& sq_dis) const;
+		void searchSurfMap(const pcl::PointXYZI& point, std::vector<pcl::PointXYZI>& near_points, std::vector<float>& sq_dis) const;
+		void updateDownsampledPointsToMap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& downsampledEdgeCloud, const pcl::PointCloud<pcl::PointXYZI>::Ptr& downsampledSurfCloud, 
+										  const sensor_msgs::ImageConstPtr& image_in, const int sequence_number);
 		void addPointsToMap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& downsampledEdgeCloud, const pcl::PointCloud<pcl::PointXYZI>::Ptr& downsampledSurfCloud);
-		void pointAssociateToMap(pcl::PointXYZI const *const pi, pcl::PointXYZI *const po);
+		void pointAssociateToMap(pcl::PointXYZI const *const pi, pcl::PointXYZI *const po) const;
 		void downSamplingToMap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_pc_in, pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_pc_out, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_pc_in, pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_pc_out);
 		void Extractkeypointandmatch(const sensor_msgs::ImageConstPtr& image_in, 
 									 const sensor_msgs::ImageConstPtr& image_in_last, 
@@ -0,0 +1,58 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _PLANE_KERNEL_H_
+#define _PLANE_KERNEL_H_
+
+#include <cstddef>
+
+//thresholds of the depth-window plane test, as integers on the 8 bit images
+struct PlaneKernelParams{
+    int half_window_size;
+    int intensity_half_window;
+    int depth_threshold;
+    int gradient_threshold;
+    int intensity_threshold;
+};
+
+//convert the thresholds of processImageRegions_surface, returns false if the
+//integer kernel cannot reproduce them (negative thresholds)
+bool makePlaneKernelParams(int half_window_size, double depth_threshold, double gradient_threshold,
+                           int intensity_threshold, PlaneKernelParams& params);
+
+//plane test of one image row y for x in [half_window_size, cols - half_window_size)
+//rows y - half_window_size ... y + half_window_size must exist in both images
+//writes the x of every plane pixel in increasing order and returns the count
+int planeKernelRow(const unsigned char* depth, size_t depth_step,
+                   const unsigned char* gray, size_t gray_step,
+                   int cols, int y, const PlaneKernelParams& params, int* plane_x);
+
+//plane test of the single pixel (x, y)
+bool planeKernelPixel(const unsigned char* depth, size_t depth_step,
+                      const unsigned char* gray, size_t gray_step,
+                      int x, int y, const PlaneKernelParams& params);
+
+//same test one pixel at a time, used for the row tails and on non-x86 builds
+int planeKernelRowScalar(const unsigned char* depth, size_t depth_step,
+                         const unsigned char* gray, size_t gray_step,
+                         int cols, int y, const PlaneKernelParams& params, int* plane_x);
+
+//non-zero min/max of the (2h+1) window along x, centred on every pixel of rows [row_begin, row_end)
+//van Herk/Gil-Werman: O(1) per pixel whatever the window size
+//windows without depth give min 255 and max 0, only x in [h, cols - h) is written
+void windowMinMaxX(const unsigned char* depth, size_t depth_step, int cols, int row_begin, int row_end, int h,
+                   unsigned char* min_x, unsigned char* max_x, size_t out_step);
+
+//same along y for the centres y in [row_begin + h, row_end - h), only rows [row_begin, row_end) are read
+void windowMinMaxY(const unsigned char* depth, size_t depth_step, int cols, int row_begin, int row_end, int h,
+                   unsigned char* min_y, unsigned char* max_y, size_t out_step);
+
+//plane test of row y with the flatness taken from the precomputed window images
+int planeKernelRowSeparable(const unsigned char* depth, size_t depth_step,
+                            const unsigned char* gray, size_t gray_step,
+                            const unsigned char* min_x, const unsigned char* max_x,
+                            const unsigned char* min_y, const unsigned char* max_y, size_t window_step,
+                            int cols, int y, const PlaneKernelParams& params, int* plane_x);
+
+#endif // _PLANE_KERNEL_H_
+
@@ -0,0 +1,75 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _POINT_CLOUD2_VIEW_H_
+#define _POINT_CLOUD2_VIEW_H_
+
+//c++ lib
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+//ros
+#include <sensor_msgs/PointCloud2.h>
+
+//PCL
+#include <pcl/point_types.h>
+
+//read-only strided x/y/z/intensity access to the data of a PointCloud2 without pcl::fromROSMsg
+//the view holds the message, so the buffer stays valid as long as the view lives
+class PointCloud2View
+{
+    public:
+        PointCloud2View();
+        explicit PointCloud2View(const sensor_msgs::PointCloud2ConstPtr& cloud_msg_in);
+
+        //false if the message has no FLOAT32 x/y/z fields, the view is empty then
+        bool valid() const { return is_valid; }
+        size_t size() const { return point_count; }
+        bool hasIntensity() const { return offset_intensity >= 0; }
+
+        float x(size_t i) const { return readFloat(pointData(i) + offset_x); }
+        float y(size_t i) const { return readFloat(pointData(i) + offset_y); }
+        float z(size_t i) const { return readFloat(pointData(i) + offset_z); }
+        //0 when the message has no intensity field
+        float intensity(size_t i) const { return offset_intensity >= 0 ? readFloat(pointData(i) + offset_intensity) : 0.0f; }
+        pcl::PointXYZI point(size_t i) const {
+            const uint8_t* point_data = pointData(i);
+            pcl::PointXYZI point_out;
+            point_out.x = readFloat(point_data + offset_x);
+            point_out.y = readFloat(point_data + offset_y);
+            point_out.z = readFloat(point_data + offset_z);
+            point_out.intensity = offset_intensity >= 0 ? readFloat(point_data + offset_intensity) : 0.0f;
+            return point_out;
+        }
+
+        const sensor_msgs::PointCloud2& message() const { return *cloud_msg; }
+
+    private:
+        sensor_msgs::PointCloud2ConstPtr cloud_msg;
+        const uint8_t* data;
+        bool is_valid;
+        size_t point_count;
+        size_t width;
+        size_t point_step;
+        size_t row_step;
+        bool packed_rows;       //row_step == width * point_step, point i is at i * point_step
+        int offset_x;
+        int offset_y;
+        int offset_z;
+        int offset_intensity;   //-1 if missing
+
+        const uint8_t* pointData(size_t i) const {
+            if (packed_rows)
+                return data + i * point_step;
+            return data + (i / width) * row_step + (i % width) * point_step;
+        }
+        static float readFloat(const uint8_t* field_data) {
+            float value;
+            memcpy(&value, field_data, sizeof(value));
+            return value;
+        }
+};
+
+#endif // _POINT_CLOUD2_VIEW_H_
+
@@ -0,0 +1,46 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _QUEUE_DIAGNOSTICS_H_
+#define _QUEUE_DIAGNOSTICS_H_
+
+//c++ lib
+#include <string>
+#include <vector>
+
+//ros lib
+#include <ros/ros.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+#include <diagnostic_msgs/KeyValue.h>
+
+//LOCAL LIB
+#include "blockingQueue.h"
+
+//size, cap and drop counter of the input queues of one node, published on /diagnostics
+//the status is WARN when frames were dropped since the last report
+class QueueDiagnostics
+{
+    public:
+        QueueDiagnostics();
+        void init(ros::NodeHandle& nh, const std::string& stage_name);
+        template <typename T>
+        void addQueue(const std::string& queue_name, const BlockingQueue<T>& queue){
+            addQueue(queue_name, queue.size(), queue.maxSize(), queue.queuePolicy(), queue.dropped());
+        }
+        void addQueue(const std::string& queue_name, size_t size, size_t capacity, QueuePolicy policy, unsigned long dropped);
+        //publish the queues added since the last call
+        void publish();
+
+    private:
+        ros::Publisher pub_diagnostics;
+        std::string name;
+        std::vector<diagnostic_msgs::KeyValue> values;
+        unsigned long dropped_total;
+        unsigned long dropped_reported;
+
+        void addValue(const std::string& key, const std::string& value);
+};
+
+#endif // _QUEUE_DIAGNOSTICS_H_
+
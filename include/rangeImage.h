@@ -0,0 +1,38 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _RANGE_IMAGE_H_
+#define _RANGE_IMAGE_H_
+
+//c++ lib
+#include <vector>
+
+//ros
+#include <sensor_msgs/PointCloud2.h>
+
+//PCL
+#include <pcl/point_types.h>
+
+//LOCAL LIB
+#include "lidar.h"
+#include "pointCloud2View.h"
+
+//organized ring x azimuth image of one scan, filled straight from the PointCloud2 buffer
+//the cells are allocated once and reused for every frame
+class RangeImage
+{
+    public:
+        RangeImage();
+        void init(int rows_in, int cols_in);
+        //bin every point of the message, the first point of a cell is kept
+        //returns false if the message has no float x/y/z fields
+        bool fill(const PointCloud2View& cloud_view, const lidar::Lidar& lidar_param, bool use_ring_field);
+
+        int rows;
+        int cols;
+        std::vector<pcl::PointXYZI, Eigen::aligned_allocator<pcl::PointXYZI>> cells;     //row major, cells[row * cols + col]
+        std::vector<unsigned char> valid;
+};
+
+#endif // _RANGE_IMAGE_H_
+
@@ -0,0 +1,129 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _SPSC_QUEUE_H_
+#define _SPSC_QUEUE_H_
+
+//c++ lib
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+//bounded ring buffer between exactly one producer thread and one consumer thread
+//push/pop are lock-free while the ring is neither full nor empty, otherwise the caller
+//sleeps on a condition variable: pop blocks on an empty ring and push blocks on a full one (back-pressure)
+template <typename T>
+class SpscQueue
+{
+    public:
+        //capacity is rounded up to a power of two
+        explicit SpscQueue(size_t capacity_in){
+            size_t capacity_pow2 = 1;
+            while(capacity_pow2 < capacity_in)
+                capacity_pow2 <<= 1;
+            slots.resize(capacity_pow2);
+            mask = capacity_pow2 - 1;
+            head.store(0);
+            tail.store(0);
+            closed.store(false);
+            consumer_waiting.store(false);
+            producer_waiting.store(false);
+        }
+
+        //blocks while the ring is full, returns false if the queue was closed
+        bool push(T item){
+            size_t t = tail.load(std::memory_order_relaxed);
+            if(t - head.load(std::memory_order_acquire) > mask){
+                std::unique_lock<std::mutex> lock(wait_mutex);
+                producer_waiting.store(true);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                not_full.wait(lock, [&]{ return closed.load() || t - head.load(std::memory_order_acquire) <= mask; });
+                producer_waiting.store(false);
+            }
+            if(closed.load())
+                return false;
+            slots[t & mask] = std::move(item);
+            tail.store(t + 1, std::memory_order_release);
+            //the store of tail has to be visible before the flag of the consumer is read
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(consumer_waiting.load()){
+                std::lock_guard<std::mutex> lock(wait_mutex);
+                not_empty.notify_one();
+            }
+            return true;
+        }
+
+        //blocks while the ring is empty, returns false once the queue is closed and drained
+        bool pop(T& item){
+            size_t h = head.load(std::memory_order_relaxed);
+            if(tail.load(std::memory_order_acquire) == h){
+                std::unique_lock<std::mutex> lock(wait_mutex);
+                consumer_waiting.store(true);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                not_empty.wait(lock, [&]{ return closed.load() || tail.load(std::memory_order_acquire) != h; });
+                consumer_waiting.store(false);
+                if(tail.load(std::memory_order_acquire) == h)
+                    return false;
+            }
+            item = std::move(slots[h & mask]);
+            slots[h & mask] = T();
+            head.store(h + 1, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(producer_waiting.load()){
+                std::lock_guard<std::mutex> lock(wait_mutex);
+                not_full.notify_one();
+            }
+            return true;
+        }
+
+        //wake both sides, push fails from now on and pop drains what is left
+        void close(){
+            std::lock_guard<std::mutex> lock(wait_mutex);
+            closed.store(true);
+            not_empty.notify_all();
+            not_full.notify_all();
+        }
+
+        //number of queued items, exact only when called from the producer or the consumer
+        size_t size() const{
+            return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const{
+            return mask + 1;
+        }
+
+        //new of c++14 does not honour alignas(64) of the members below,
+        //over-allocate and keep the address of the block in front of the aligned object
+        static void* operator new(size_t size){
+            void* raw = ::operator new(size + 64 + sizeof(void*));
+            size_t aligned = (reinterpret_cast<size_t>(raw) + sizeof(void*) + 63) & ~(size_t)63;
+            reinterpret_cast<void**>(aligned)[-1] = raw;
+            return reinterpret_cast<void*>(aligned);
+        }
+
+        static void operator delete(void* ptr){
+            if(ptr != NULL)
+                ::operator delete(reinterpret_cast<void**>(ptr)[-1]);
+        }
+
+    private:
+        std::vector<T> slots;
+        size_t mask;
+        //head and tail on their own cache lines, each one is written by one side only
+        alignas(64) std::atomic<size_t> head;     //next slot to read, written by the consumer
+        alignas(64) std::atomic<size_t> tail;     //next slot to write, written by the producer
+        alignas(64) std::atomic<bool> closed;
+        std::atomic<bool> consumer_waiting;
+        std::atomic<bool> producer_waiting;
+        std::mutex wait_mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+};
+
+#endif // _SPSC_QUEUE_H_
+
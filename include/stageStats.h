@@ -0,0 +1,42 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _STAGE_STATS_H_
+#define _STAGE_STATS_H_
+
+//c++ lib
+#include <string>
+#include <cstddef>
+#include <chrono>
+
+//queue depth, time spent waiting in the input queue and processing time of one pipeline stage
+//plus a histogram of the latency (wait + process), updated by the stage thread only, no locking
+class StageStats
+{
+    public:
+        StageStats();
+        //queue_depth: items left in the input queue when this one was taken
+        void addFrame(size_t queue_depth, double wait_ms, double process_ms);
+        int frames() const;
+        //one line with mean/max of every value since the last reset
+        std::string summary() const;
+        //latency histogram since the last reset, "<1ms:n 1-2ms:n ... >500ms:n"
+        std::string histogram() const;
+        void reset();
+
+        static const int num_buckets = 10;
+        static double elapsedMs(const std::chrono::steady_clock::time_point& start, const std::chrono::steady_clock::time_point& end);
+
+    private:
+        int frame_count;
+        double depth_sum;
+        size_t depth_max;
+        double wait_sum;
+        double wait_max;
+        double process_sum;
+        double process_max;
+        int latency_buckets[num_buckets];
+};
+
+#endif // _STAGE_STATS_H_
+
@@ -0,0 +1,52 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+//c++ lib
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//long-lived worker pool, tasks of one parallelFor are spread over per-worker queues
+//and idle workers steal from the back of the other queues
+class ThreadPool
+{
+    public:
+        //num_threads <= 0 means std::thread::hardware_concurrency()
+        explicit ThreadPool(int num_threads);
+        ~ThreadPool();
+
+        //run task(0) ... task(num_tasks-1) and block until all of them are done
+        //the calling thread works on the tasks as well
+        void parallelFor(int num_tasks, const std::function<void(int)>& task);
+        int size() const;
+
+    private:
+        struct TaskQueue{
+            std::mutex mutex;
+            std::deque<int> tasks;
+        };
+
+        std::vector<std::thread> workers;
+        std::vector<std::unique_ptr<TaskQueue>> queues;
+        std::mutex pool_mutex;
+        std::condition_variable start_condition;
+        std::condition_variable done_condition;
+        const std::function<void(int)>* current_task;
+        unsigned long generation;
+        int active_workers;
+        bool stop;
+
+        void workerLoop(int queue_id);
+        void runTasks(int queue_id, const std::function<void(int)>& task);
+        bool popTask(int queue_id, int& task_id);
+};
+
+#endif // _THREAD_POOL_H_
+
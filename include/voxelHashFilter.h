@@ -0,0 +1,63 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _VOXEL_HASH_FILTER_H_
+#define _VOXEL_HASH_FILTER_H_
+
+//c++ lib
+#include <vector>
+#include <cstdint>
+#include <Eigen/Core>
+
+//PCL
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+//LOCAL LIB
+#include "pointCloud2View.h"
+
+//voxel downsampling with a hash of the voxel keys instead of the sort of pcl::VoxelGrid
+//points are grouped in O(n), only the occupied voxels are sorted, the hash table is kept between calls
+//same interface and same output order as pcl::VoxelGrid (voxels by z, then y, then x) so it can replace it in place
+class VoxelHashFilter
+{
+    public:
+        VoxelHashFilter();
+        void setLeafSize(float leaf_x, float leaf_y, float leaf_z);
+        //false: centroid of x, y, z and intensity (as pcl::VoxelGrid), true: first point of each voxel
+        void setKeepFirstPoint(bool keep_first_in);
+        void setInputCloud(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& cloud_in);
+        //pc_out may be the input cloud
+        void filter(pcl::PointCloud<pcl::PointXYZI>& pc_out);
+        //downsample the points of a PointCloud2 straight from the message buffer (setInputCloud is not used)
+        void filter(const PointCloud2View& view_in, pcl::PointCloud<pcl::PointXYZI>& pc_out);
+
+    private:
+        struct HashSlot{
+            uint64_t key;
+            int voxel;
+            uint32_t stamp;     //slot is used in this call only if stamp == current_stamp
+        };
+        struct VoxelSum{
+            double x, y, z, intensity;
+            int count;
+            int first;
+            int ix, iy, iz;
+        };
+
+        pcl::PointCloud<pcl::PointXYZI>::ConstPtr input;
+        float inverse_leaf[3];
+        bool keep_first;
+        std::vector<HashSlot> table;
+        std::vector<VoxelSum> voxels;
+        uint32_t current_stamp;
+        std::vector<pcl::PointXYZI, Eigen::aligned_allocator<pcl::PointXYZI>> kept_points;
+
+        void prepareTable(size_t point_count);
+        void addPoint(const pcl::PointXYZI& point, int index);
+        void sortVoxels();
+        void writeCentroids(pcl::PointCloud<pcl::PointXYZI>& pc_out);
+};
+
+#endif // _VOXEL_HASH_FILTER_H_
+
@@ -0,0 +1,65 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+#ifndef _VOXEL_HASH_MAP_H_
+#define _VOXEL_HASH_MAP_H_
+
+//c++ lib
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+//PCL
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+//eigen
+#include <Eigen/Dense>
+
+//local map as a hash of voxels, each one holding up to voxel_capacity points
+//inserting a scan is O(points), cropping evicts whole voxels and nothing is rebuilt
+//the neighbor search looks at the 27 voxels around the query point only, so it is exact
+//for neighbors closer than the voxel size and misses farther ones
+class VoxelHashMap
+{
+    public:
+        static const int voxel_capacity = 20;
+
+        VoxelHashMap();
+        //voxel_size_in: edge of a voxel and radius of the exact search
+        //min_distance_in: a point closer than this to a point of its voxel is not inserted
+        void setResolution(float voxel_size_in, float min_distance_in);
+        void addPoints(const pcl::PointCloud<pcl::PointXYZI>& points_in);
+        //evict the voxels whose center is outside [box_min, box_max]
+        void cropToBox(const Eigen::Vector3f& box_min, const Eigen::Vector3f& box_max);
+        void clear();
+        int size() const;
+        //k nearest points sorted by increasing distance among the 27 voxels around the point
+        //const and read-only, may run from several threads as long as the map is not modified
+        void nearestKSearch(const pcl::PointXYZI& point, int k, std::vector<pcl::PointXYZI>& near_points, std::vector<float>& sq_dis) const;
+        void getPoints(pcl::PointCloud<pcl::PointXYZI>& points_out) const;
+
+    private:
+        struct MapPoint{
+            float x, y, z, intensity;
+        };
+        struct Voxel{
+            int ix, iy, iz;
+            int count;
+            MapPoint points[voxel_capacity];
+        };
+        struct VoxelKeyHash{
+            size_t operator()(uint64_t key) const;
+        };
+
+        std::unordered_map<uint64_t, Voxel, VoxelKeyHash> voxels;
+        float voxel_size;
+        float inverse_voxel_size;
+        float min_sq_distance;
+        int point_count;
+
+        void voxelIndex(float x, float y, float z, int& ix, int& iy, int& iz) const;
+};
+
+#endif // _VOXEL_HASH_MAP_H_
+
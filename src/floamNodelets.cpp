@@ -0,0 +1,86 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+//nodelet versions of the three stages, load them into one manager so the
+//edge/surf/filtered clouds and the image are passed as pointers instead of serialized
+//each stage keeps its state in namespace globals, so it is set up once per manager process,
+//loading it again (also after an unload) only logs a warning
+
+//ros lib
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+//local lib
+#include "floamNodes.h"
+
+namespace floam{
+
+class LaserProcessingNodelet : public nodelet::Nodelet
+{
+    public:
+        LaserProcessingNodelet(){
+            started = false;
+        }
+
+        //unload or manager shutdown: stop the worker before the stage globals go away
+        virtual ~LaserProcessingNodelet(){
+            if(started)
+                laser_processing_node::shutdown();
+        }
+
+    private:
+        bool started;
+
+        virtual void onInit(){
+            started = laser_processing_node::setup(getNodeHandle());
+        }
+};
+
+class OdomEstimationNodelet : public nodelet::Nodelet
+{
+    public:
+        OdomEstimationNodelet(){
+            started = false;
+        }
+
+        //unload or manager shutdown: stop the worker before the stage globals go away
+        virtual ~OdomEstimationNodelet(){
+            if(started)
+                odom_estimation_node::shutdown();
+        }
+
+    private:
+        bool started;
+
+        virtual void onInit(){
+            started = odom_estimation_node::setup(getNodeHandle());
+        }
+};
+
+class LaserMappingNodelet : public nodelet::Nodelet
+{
+    public:
+        LaserMappingNodelet(){
+            started = false;
+        }
+
+        //unload or manager shutdown: stop the worker before the stage globals go away
+        virtual ~LaserMappingNodelet(){
+            if(started)
+                laser_mapping_node::shutdown();
+        }
+
+    private:
+        bool started;
+
+        virtual void onInit(){
+            started = laser_mapping_node::setup(getNodeHandle());
+        }
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(floam::LaserProcessingNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(floam::OdomEstimationNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(floam::LaserMappingNodelet, nodelet::Nodelet)
@@ -0,0 +1,181 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+//laser processing, odometry and mapping in one process, each stage on its own thread
+//the stages are connected by bounded single-producer/single-consumer ring buffers:
+//every stage sleeps on its input queue and a full queue blocks the stage in front of it,
+//down to the subscriber callback (back-pressure instead of unbounded buffers)
+
+//c++ lib
+#include <memory>
+#include <thread>
+#include <chrono>
+
+//ros lib
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Image.h>
+#include <nav_msgs/Odometry.h>
+#include <message_filters/subscriber.h>
+#include <message_filters/synchronizer.h>
+#include <message_filters/sync_policies/approximate_time.h>
+
+//local lib
+#include "floamNodes.h"
+#include "spscQueue.h"
+#include "stageStats.h"
+
+typedef std::chrono::steady_clock PipelineClock;
+
+//synchronized lidar/camera pair from the subscriber
+class InputFrame{
+    public:
+        sensor_msgs::PointCloud2ConstPtr cloud;
+        sensor_msgs::ImageConstPtr image;
+        PipelineClock::time_point enqueued;
+};
+
+//output of the laser processing stage
+class FeatureFrame{
+    public:
+        laser_processing_node::ProcessedFrame frame;
+        PipelineClock::time_point enqueued;
+};
+
+//output of the odometry stage, the filtered cloud is registered by the mapping
+class OdometryFrame{
+    public:
+        sensor_msgs::PointCloud2Ptr filtered;
+        nav_msgs::OdometryPtr odometry;
+        PipelineClock::time_point enqueued;
+};
+
+std::unique_ptr<SpscQueue<InputFrame>> inputQueue;
+std::unique_ptr<SpscQueue<FeatureFrame>> featureQueue;
+std::unique_ptr<SpscQueue<OdometryFrame>> odometryQueue;
+
+StageStats processingStats;
+StageStats odomStats;
+StageStats mappingStats;
+const int report_frames = 100;
+
+//log and restart the stats of a stage every report_frames frames
+void reportStats(const char* stage_name, StageStats& stats)
+{
+    if(stats.frames() < report_frames)
+        return;
+    ROS_INFO("pipeline %s: %s", stage_name, stats.summary().c_str());
+    ROS_INFO("pipeline %s latency: %s", stage_name, stats.histogram().c_str());
+    stats.reset();
+}
+
+//runs on the spinner thread, blocks while the input queue is full
+void velodyneHandler(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg, const sensor_msgs::ImageConstPtr &laserImageMsg)
+{
+    InputFrame input;
+    input.cloud = laserCloudMsg;
+    input.image = laserImageMsg;
+    input.enqueued = PipelineClock::now();
+    inputQueue->push(input);
+}
+
+void laser_processing(){
+    InputFrame input;
+    while(inputQueue->pop(input)){
+        size_t queue_depth = inputQueue->size();
+        PipelineClock::time_point start = PipelineClock::now();
+
+        FeatureFrame output;
+        laser_processing_node::processFrame(input.cloud, input.image, output.frame);
+        laser_processing_node::publish(output.frame);
+
+        output.enqueued = PipelineClock::now();
+        processingStats.addFrame(queue_depth, StageStats::elapsedMs(input.enqueued, start), StageStats::elapsedMs(start, output.enqueued));
+        reportStats("laser processing", processingStats);
+        if(!featureQueue->push(output))
+            break;
+    }
+    featureQueue->close();
+}
+
+void odom_estimation(){
+    FeatureFrame input;
+    while(featureQueue->pop(input)){
+        size_t queue_depth = featureQueue->size();
+        PipelineClock::time_point start = PipelineClock::now();
+
+        //edge, surf and image come from the same frame, no time alignment needed
+        PointCloud2View pointcloud_edge_in(input.frame.edge);
+        PointCloud2View pointcloud_surf_in(input.frame.surf);
+        OdometryFrame output;
+        output.filtered = input.frame.filtered;
+        output.odometry = odom_estimation_node::processFrame(pointcloud_edge_in, pointcloud_surf_in, input.frame.image, input.frame.surf->header.stamp);
+        odom_estimation_node::publish(output.odometry);
+
+        output.enqueued = PipelineClock::now();
+        odomStats.addFrame(queue_depth, StageStats::elapsedMs(input.enqueued, start), StageStats::elapsedMs(start, output.enqueued));
+        reportStats("odom estimation", odomStats);
+        if(!odometryQueue->push(output))
+            break;
+    }
+    odometryQueue->close();
+}
+
+void laser_mapping(){
+    OdometryFrame input;
+    while(odometryQueue->pop(input)){
+        size_t queue_depth = odometryQueue->size();
+        PipelineClock::time_point start = PipelineClock::now();
+
+        PointCloud2View pointcloud_in(input.filtered);
+        Eigen::Isometry3d current_pose = laser_mapping_node::poseFromOdometry(*input.odometry);
+        sensor_msgs::PointCloud2Ptr map_msg = laser_mapping_node::processFrame(pointcloud_in, current_pose, input.filtered->header.stamp);
+        laser_mapping_node::publish(map_msg);
+
+        mappingStats.addFrame(queue_depth, StageStats::elapsedMs(input.enqueued, start), StageStats::elapsedMs(start, PipelineClock::now()));
+        reportStats("laser mapping", mappingStats);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "main");
+    ros::NodeHandle nh;
+
+    int pipeline_queue_size = 4;
+    nh.getParam("/pipeline_queue_size", pipeline_queue_size);
+    if(pipeline_queue_size < 1)
+        pipeline_queue_size = 1;
+
+    laser_processing_node::init(nh);
+    odom_estimation_node::init(nh);
+    laser_mapping_node::init(nh);
+    laser_processing_node::advertise(nh);
+    odom_estimation_node::advertise(nh);
+    laser_mapping_node::advertise(nh);
+
+    inputQueue.reset(new SpscQueue<InputFrame>(pipeline_queue_size));
+    featureQueue.reset(new SpscQueue<FeatureFrame>(pipeline_queue_size));
+    odometryQueue.reset(new SpscQueue<OdometryFrame>(pipeline_queue_size));
+
+    std::thread laser_processing_process{laser_processing};
+    std::thread odom_estimation_process{odom_estimation};
+    std::thread laser_mapping_process{laser_mapping};
+
+    typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::PointCloud2, sensor_msgs::Image> SyncPolicy;
+    message_filters::Subscriber<sensor_msgs::PointCloud2> subLaserCloud(nh , "/velodyne_points", 100);
+    message_filters::Subscriber<sensor_msgs::Image> subImageLeft(nh, "/image_left", 100);
+    message_filters::Synchronizer<SyncPolicy> sync(SyncPolicy(30), subLaserCloud, subImageLeft);
+    sync.registerCallback(boost::bind(&velodyneHandler, _1, _2));
+
+    ros::spin();
+
+    //the stages drain their queues and close the next one
+    inputQueue->close();
+    laser_processing_process.join();
+    odom_estimation_process.join();
+    laser_mapping_process.join();
+
+    return 0;
+}
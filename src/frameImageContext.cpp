@@ -0,0 +1,45 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "frameImageContext.h"
+
+FrameImageContext::FrameImageContext(const sensor_msgs::ImageConstPtr& image_msg_in, bool debug_in)
+        : image_msg(image_msg_in), debug_enabled(debug_in){
+
+}
+
+const cv::Mat& FrameImageContext::bgr(){
+    //toCvShare only converts (and copies) when the encoding differs
+    if(!bgr_ptr)
+        bgr_ptr = cv_bridge::toCvShare(image_msg, sensor_msgs::image_encodings::BGR8);
+    return bgr_ptr->image;
+}
+
+const cv::Mat& FrameImageContext::gray(){
+    if(gray_image.empty()){
+        if(image_msg->encoding == sensor_msgs::image_encodings::MONO8){
+            mono_ptr = cv_bridge::toCvShare(image_msg, sensor_msgs::image_encodings::MONO8);
+            gray_image = mono_ptr->image;
+        }else{
+            cv::cvtColor(bgr(), gray_image, cv::COLOR_BGR2GRAY);
+        }
+    }
+    return gray_image;
+}
+
+const cv::Mat& FrameImageContext::blurred(){
+    if(blurred_image.empty())
+        cv::GaussianBlur(gray(), blurred_image, cv::Size(3, 3), 1.0);
+    return blurred_image;
+}
+
+cv::Mat& FrameImageContext::debugImage(){
+    if(!debug_ptr)
+        debug_ptr = cv_bridge::toCvCopy(image_msg, sensor_msgs::image_encodings::BGR8);
+    return debug_ptr->image;
+}
+
+bool FrameImageContext::debug() const{
+    return debug_enabled;
+}
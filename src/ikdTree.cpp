@@ -0,0 +1,350 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "ikdTree.h"
+
+//c++ lib
+#include <algorithm>
+#include <cmath>
+
+//rebuild criteria of a subtree (ikd-tree): one side holds more than alpha_balance of the nodes
+//or more than alpha_delete of the nodes are deleted, small subtrees are left alone
+static const float alpha_balance = 0.7f;
+static const float alpha_delete = 0.5f;
+static const int min_rebuild_size = 16;
+
+static inline float pointCoord(const pcl::PointXYZI& point, int axis){
+    return axis == 0 ? point.x : (axis == 1 ? point.y : point.z);
+}
+
+static inline bool pointInBox(const pcl::PointXYZI& point, const float box_min[3], const float box_max[3]){
+    return point.x >= box_min[0] && point.x <= box_max[0]
+        && point.y >= box_min[1] && point.y <= box_max[1]
+        && point.z >= box_min[2] && point.z <= box_max[2];
+}
+
+IkdTree::IkdTree(){
+    root = -1;
+    resolution = 0;
+}
+
+void IkdTree::setDownsampleResolution(float resolution_in){
+    resolution = resolution_in;
+}
+
+void IkdTree::clear(){
+    nodes.clear();
+    free_nodes.clear();
+    root = -1;
+}
+
+int IkdTree::size() const{
+    if(root < 0)
+        return 0;
+    return nodes[root].tree_size - nodes[root].invalid_size;
+}
+
+void IkdTree::addPoints(const pcl::PointCloud<pcl::PointXYZI>& points_in){
+    for(size_t i = 0; i < points_in.points.size(); i++){
+        const pcl::PointXYZI& point = points_in.points[i];
+        if(resolution > 0){
+            //keep the first point of every voxel, as VoxelHashFilter::setKeepFirstPoint
+            float voxel_min[3], voxel_max[3];
+            for(int axis = 0; axis < 3; axis++){
+                voxel_min[axis] = std::floor(pointCoord(point, axis) / resolution) * resolution;
+                voxel_max[axis] = voxel_min[axis] + resolution;
+            }
+            if(hasPointInBox(root, voxel_min, voxel_max))
+                continue;
+        }
+        root = insert(root, point);
+    }
+}
+
+void IkdTree::cropToBox(const Eigen::Vector3f& box_min, const Eigen::Vector3f& box_max){
+    float crop_min[3] = {box_min.x(), box_min.y(), box_min.z()};
+    float crop_max[3] = {box_max.x(), box_max.y(), box_max.z()};
+    root = crop(root, crop_min, crop_max);
+    if(root >= 0 && nodes[root].invalid_size == nodes[root].tree_size)
+        clear();
+}
+
+void IkdTree::nearestKSearch(const pcl::PointXYZI& point, int k, std::vector<pcl::PointXYZI>& near_points, std::vector<float>& sq_dis) const{
+    near_points.clear();
+    sq_dis.clear();
+    if(k <= 0)
+        return;
+    //max-heap of (squared distance, node), the front is the farthest of the k best
+    std::vector<std::pair<float, int>> heap;
+    heap.reserve(k);
+    search(root, point, k, heap);
+    std::sort_heap(heap.begin(), heap.end());
+    for(size_t i = 0; i < heap.size(); i++){
+        near_points.push_back(nodes[heap[i].second].point);
+        sq_dis.push_back(heap[i].first);
+    }
+}
+
+void IkdTree::getPoints(pcl::PointCloud<pcl::PointXYZI>& points_out) const{
+    getPoints(root, points_out);
+}
+
+int IkdTree::newNode(const pcl::PointXYZI& point){
+    int index;
+    if(!free_nodes.empty()){
+        index = free_nodes.back();
+        free_nodes.pop_back();
+    }else{
+        index = (int)nodes.size();
+        nodes.push_back(Node());
+    }
+    Node& node = nodes[index];
+    node.point = point;
+    node.axis = 0;
+    node.left = -1;
+    node.right = -1;
+    node.tree_size = 1;
+    node.invalid_size = 0;
+    node.deleted = false;
+    node.tree_deleted = false;
+    for(int axis = 0; axis < 3; axis++){
+        node.box_min[axis] = pointCoord(point, axis);
+        node.box_max[axis] = pointCoord(point, axis);
+    }
+    return index;
+}
+
+int IkdTree::build(PointVector& points, int begin, int end){
+    if(begin >= end)
+        return -1;
+
+    //split on the axis of the largest extent at the median
+    float extent_min[3] = {points[begin].x, points[begin].y, points[begin].z};
+    float extent_max[3] = {points[begin].x, points[begin].y, points[begin].z};
+    for(int i = begin + 1; i < end; i++){
+        for(int axis = 0; axis < 3; axis++){
+            extent_min[axis] = std::min(extent_min[axis], pointCoord(points[i], axis));
+            extent_max[axis] = std::max(extent_max[axis], pointCoord(points[i], axis));
+        }
+    }
+    int split_axis = 0;
+    for(int axis = 1; axis < 3; axis++){
+        if(extent_max[axis] - extent_min[axis] > extent_max[split_axis] - extent_min[split_axis])
+            split_axis = axis;
+    }
+    int mid = (begin + end) / 2;
+    std::nth_element(points.begin() + begin, points.begin() + mid, points.begin() + end,
+                     [split_axis](const pcl::PointXYZI& a, const pcl::PointXYZI& b){
+                         return pointCoord(a, split_axis) < pointCoord(b, split_axis);
+                     });
+
+    int index = newNode(points[mid]);
+    nodes[index].axis = split_axis;
+    //nodes may be reallocated by the recursion, no reference is kept across it
+    int left = build(points, begin, mid);
+    int right = build(points, mid + 1, end);
+    nodes[index].left = left;
+    nodes[index].right = right;
+    update(index);
+    return index;
+}
+
+int IkdTree::rebuild(int node, const pcl::PointXYZI* extra_point){
+    rebuild_points.clear();
+    collect(node, false, rebuild_points);
+    if(extra_point != nullptr)
+        rebuild_points.push_back(*extra_point);
+    return build(rebuild_points, 0, (int)rebuild_points.size());
+}
+
+void IkdTree::collect(int node, bool tree_deleted, PointVector& points){
+    if(node < 0)
+        return;
+    tree_deleted = tree_deleted || nodes[node].tree_deleted;
+    if(!tree_deleted && !nodes[node].deleted)
+        points.push_back(nodes[node].point);
+    collect(nodes[node].left, tree_deleted, points);
+    collect(nodes[node].right, tree_deleted, points);
+    free_nodes.push_back(node);
+}
+
+int IkdTree::insert(int node, const pcl::PointXYZI& point){
+    if(node < 0)
+        return newNode(point);
+    pushDown(node);
+
+    Node& current = nodes[node];
+    bool go_left = pointCoord(point, current.axis) < pointCoord(current.point, current.axis);
+    int left_size = (current.left >= 0 ? nodes[current.left].tree_size : 0) + (go_left ? 1 : 0);
+    int right_size = (current.right >= 0 ? nodes[current.right].tree_size : 0) + (go_left ? 0 : 1);
+    int new_size = current.tree_size + 1;
+    //the topmost subtree that the new point unbalances is rebuilt with the point, nothing below is touched
+    if(new_size >= min_rebuild_size
+       && (std::max(left_size, right_size) > alpha_balance * (new_size - 1) || current.invalid_size > alpha_delete * new_size))
+        return rebuild(node, &point);
+
+    if(go_left){
+        int left = insert(current.left, point);
+        nodes[node].left = left;
+    }else{
+        int right = insert(current.right, point);
+        nodes[node].right = right;
+    }
+    update(node);
+    return node;
+}
+
+int IkdTree::crop(int node, const float box_min[3], const float box_max[3]){
+    if(node < 0 || nodes[node].invalid_size == nodes[node].tree_size)
+        return node;
+
+    Node& current = nodes[node];
+    bool inside = true;
+    bool outside = false;
+    for(int axis = 0; axis < 3; axis++){
+        if(current.box_min[axis] < box_min[axis] || current.box_max[axis] > box_max[axis])
+            inside = false;
+        if(current.box_max[axis] < box_min[axis] || current.box_min[axis] > box_max[axis])
+            outside = true;
+    }
+    if(inside)
+        return node;
+    if(outside){
+        markTreeDeleted(node);
+        return node;
+    }
+
+    pushDown(node);
+    if(!current.deleted && !pointInBox(current.point, box_min, box_max))
+        current.deleted = true;
+    int left = crop(current.left, box_min, box_max);
+    int right = crop(nodes[node].right, box_min, box_max);
+    nodes[node].left = left;
+    nodes[node].right = right;
+    update(node);
+    if(needRebuild(node))
+        return rebuild(node, nullptr);
+    return node;
+}
+
+void IkdTree::markTreeDeleted(int node){
+    Node& current = nodes[node];
+    current.deleted = true;
+    current.tree_deleted = true;
+    current.invalid_size = current.tree_size;
+}
+
+void IkdTree::pushDown(int node){
+    if(!nodes[node].tree_deleted)
+        return;
+    if(nodes[node].left >= 0)
+        markTreeDeleted(nodes[node].left);
+    if(nodes[node].right >= 0)
+        markTreeDeleted(nodes[node].right);
+    nodes[node].tree_deleted = false;
+}
+
+void IkdTree::update(int node){
+    Node& current = nodes[node];
+    current.tree_size = 1;
+    current.invalid_size = current.deleted ? 1 : 0;
+    for(int axis = 0; axis < 3; axis++){
+        current.box_min[axis] = pointCoord(current.point, axis);
+        current.box_max[axis] = pointCoord(current.point, axis);
+    }
+    int children[2] = {current.left, current.right};
+    for(int c = 0; c < 2; c++){
+        if(children[c] < 0)
+            continue;
+        const Node& child = nodes[children[c]];
+        current.tree_size += child.tree_size;
+        current.invalid_size += child.invalid_size;
+        for(int axis = 0; axis < 3; axis++){
+            current.box_min[axis] = std::min(current.box_min[axis], child.box_min[axis]);
+            current.box_max[axis] = std::max(current.box_max[axis], child.box_max[axis]);
+        }
+    }
+}
+
+bool IkdTree::needRebuild(int node) const{
+    const Node& current = nodes[node];
+    if(current.tree_size < min_rebuild_size)
+        return false;
+    int left_size = current.left >= 0 ? nodes[current.left].tree_size : 0;
+    int right_size = current.right >= 0 ? nodes[current.right].tree_size : 0;
+    return std::max(left_size, right_size) > alpha_balance * (current.tree_size - 1)
+        || current.invalid_size > alpha_delete * current.tree_size;
+}
+
+bool IkdTree::hasPointInBox(int node, const float box_min[3], const float box_max[3]) const{
+    if(node < 0)
+        return false;
+    const Node& current = nodes[node];
+    if(current.invalid_size == current.tree_size)
+        return false;
+    for(int axis = 0; axis < 3; axis++){
+        if(current.box_max[axis] < box_min[axis] || current.box_min[axis] > box_max[axis])
+            return false;
+    }
+    if(!current.deleted && pointInBox(current.point, box_min, box_max))
+        return true;
+    return hasPointInBox(current.left, box_min, box_max) || hasPointInBox(current.right, box_min, box_max);
+}
+
+//squared distance from the point to the bounding box of a subtree
+static inline float boxSquaredDistance(const pcl::PointXYZI& point, const float box_min[3], const float box_max[3]){
+    float distance = 0;
+    for(int axis = 0; axis < 3; axis++){
+        float value = pointCoord(point, axis);
+        float outside = std::max(0.0f, std::max(box_min[axis] - value, value - box_max[axis]));
+        distance += outside * outside;
+    }
+    return distance;
+}
+
+void IkdTree::search(int node, const pcl::PointXYZI& point, int k, std::vector<std::pair<float, int>>& heap) const{
+    if(node < 0)
+        return;
+    const Node& current = nodes[node];
+    //fully deleted subtrees (tree_deleted included) are skipped as a whole
+    if(current.invalid_size == current.tree_size)
+        return;
+    if((int)heap.size() == k && boxSquaredDistance(point, current.box_min, current.box_max) >= heap.front().first)
+        return;
+
+    if(!current.deleted){
+        float dx = current.point.x - point.x;
+        float dy = current.point.y - point.y;
+        float dz = current.point.z - point.z;
+        float distance = dx * dx + dy * dy + dz * dz;
+        if((int)heap.size() < k){
+            heap.push_back(std::make_pair(distance, node));
+            std::push_heap(heap.begin(), heap.end());
+        }else if(distance < heap.front().first){
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = std::make_pair(distance, node);
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    //nearer child first so the far one is pruned more often
+    int first = current.left;
+    int second = current.right;
+    if(pointCoord(point, current.axis) >= pointCoord(current.point, current.axis))
+        std::swap(first, second);
+    search(first, point, k, heap);
+    search(second, point, k, heap);
+}
+
+void IkdTree::getPoints(int node, pcl::PointCloud<pcl::PointXYZI>& points_out) const{
+    if(node < 0)
+        return;
+    const Node& current = nodes[node];
+    if(current.invalid_size == current.tree_size)
+        return;
+    if(!current.deleted)
+        points_out.push_back(current.point);
+    getPoints(current.left, points_out);
+    getPoints(current.right, points_out);
+}
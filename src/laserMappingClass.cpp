@@ -171,10 +171,51 @@ void LaserMappingClass::updateCurrentPointsToMap(const pcl::PointCloud<pcl::Poin
 		
 	}
 	
-	//filtering points 
-	for(int i=currentPosIdX-LASER_CELL_RANGE_HORIZONTAL;i<currentPosIdX+LASER_CELL_RANGE_HORIZONTAL+1;i++){
-		for(int j=currentPosIdY-LASER_CELL_RANGE_HORIZONTAL;j<currentPosIdY+LASER_CELL_RANGE_HORIZONTAL+1;j++){
-			for(int k=currentPosIdZ-LASER_CELL_RANGE_VERTICAL;k<currentPosIdZ+LASER_CELL_RANGE_VERTICAL+1;k++){
+	filterCellsAround(currentPosIdX, currentPosIdY, currentPosIdZ);
+
+}
+
+//update points to map, reading them straight from the message
+void LaserMappingClass::updateCurrentPointsToMap(const PointCloud2View& pc_in, const Eigen::Isometry3d& pose_current){
+	
+	int currentPosIdX = int(std::floor(pose_current.translation().x() / LASER_CELL_WIDTH + 0.5)) + origin_in_map_x;
+	int currentPosIdY = int(std::floor(pose_current.translation().y() / LASER_CELL_HEIGHT + 0.5)) + origin_in_map_y;
+	int currentPosIdZ = int(std::floor(pose_current.translation().z() / LASER_CELL_DEPTH + 0.5)) + origin_in_map_z;
+
+	//check is submap is null
+	checkPoints(currentPosIdX,currentPosIdY,currentPosIdZ);
+
+	Eigen::Matrix3f rotation = pose_current.rotation().cast<float>();
+	Eigen::Vector3f translation = pose_current.translation().cast<float>();
+
+	//save points
+	for (size_t i = 0; i < pc_in.size(); i++)
+	{
+		Eigen::Vector3f point_local(pc_in.x(i), pc_in.y(i), pc_in.z(i));
+		Eigen::Vector3f point_world = rotation * point_local + translation;
+		pcl::PointXYZI point_temp;
+		point_temp.x = point_world.x();
+		point_temp.y = point_world.y();
+		point_temp.z = point_world.z();
+		//for visualization only
+		point_temp.intensity = std::min(1.0 , std::max(point_local.z()+2.0, 0.0) / 5);
+		int currentPointIdX = int(std::floor(point_temp.x / LASER_CELL_WIDTH + 0.5)) + origin_in_map_x;
+		int currentPointIdY = int(std::floor(point_temp.y / LASER_CELL_HEIGHT + 0.5)) + origin_in_map_y;
+		int currentPointIdZ = int(std::floor(point_temp.z / LASER_CELL_DEPTH + 0.5)) + origin_in_map_z;
+
+		map[currentPointIdX][currentPointIdY][currentPointIdZ]->push_back(point_temp);
+		
+	}
+	
+	filterCellsAround(currentPosIdX, currentPosIdY, currentPosIdZ);
+
+}
+
+//filtering points of the cells around the current position
+void LaserMappingClass::filterCellsAround(int x, int y, int z){
+	for(int i=x-LASER_CELL_RANGE_HORIZONTAL;i<x+LASER_CELL_RANGE_HORIZONTAL+1;i++){
+		for(int j=y-LASER_CELL_RANGE_HORIZONTAL;j<y+LASER_CELL_RANGE_HORIZONTAL+1;j++){
+			for(int k=z-LASER_CELL_RANGE_VERTICAL;k<z+LASER_CELL_RANGE_VERTICAL+1;k++){
 				downSizeFilter.setInputCloud(map[i][j][k]);
 				downSizeFilter.filter(*(map[i][j][k]));
 			}
@@ -182,7 +223,6 @@ void LaserMappingClass::updateCurrentPointsToMap(const pcl::PointCloud<pcl::Poin
 		}
 
 	}
-
 }
 
 pcl::PointCloud<pcl::PointXYZI>::Ptr LaserMappingClass::getMap(void){
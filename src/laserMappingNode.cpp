@@ -5,9 +5,9 @@
 //c++ lib
 #include <cmath>
 #include <vector>
-#include <mutex>
-#include <queue>
+#include <algorithm>
 #include <thread>
+#include <atomic>
 #include <chrono>
 
 //ros lib
@@ -24,86 +24,132 @@
 
 //local lib
 #include "laserMappingClass.h"
+#include "floamNodes.h"
+#include "blockingQueue.h"
+#include "stageStats.h"
+#include "queueDiagnostics.h"
 #include "lidar.h"
 
 
+namespace laser_mapping_node{
+
 LaserMappingClass laserMapping;
 lidar::Lidar lidar_param;
-std::mutex mutex_lock;
-std::queue<nav_msgs::OdometryConstPtr> odometryBuf;
-std::queue<sensor_msgs::PointCloud2ConstPtr> pointCloudBuf;
+BlockingQueue<nav_msgs::OdometryConstPtr> odometryBuf;
+BlockingQueue<sensor_msgs::PointCloud2ConstPtr> pointCloudBuf;
+StageStats stageStats;
+QueueDiagnostics queueDiagnostics;
+ros::Timer diagnosticsTimer;
+std::thread laser_mapping_process;
+std::atomic<bool> is_setup(false);
+
+//queue sizes and drop counters on /diagnostics once per second
+void publishDiagnostics(const ros::TimerEvent&)
+{
+    queueDiagnostics.addQueue("odometry", odometryBuf);
+    queueDiagnostics.addQueue("cloud", pointCloudBuf);
+    queueDiagnostics.publish();
+}
 
 ros::Publisher map_pub;
+ros::Subscriber subLaserCloud;
+ros::Subscriber subOdometry;
 void odomCallback(const nav_msgs::Odometry::ConstPtr &msg)
 {
-    mutex_lock.lock();
     odometryBuf.push(msg);
-    mutex_lock.unlock();
 }
 
 void velodyneHandler(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg)
 {
-    mutex_lock.lock();
     pointCloudBuf.push(laserCloudMsg);
-    mutex_lock.unlock();
 }
 
 
+//add one registered frame to the map, returns the map message
+sensor_msgs::PointCloud2Ptr processFrame(const PointCloud2View& pointcloud_in, const Eigen::Isometry3d& current_pose, const ros::Time& pointcloud_time)
+{
+    laserMapping.updateCurrentPointsToMap(pointcloud_in,current_pose);
+
+    pcl::PointCloud<pcl::PointXYZI>::Ptr pc_map = laserMapping.getMap();
+    sensor_msgs::PointCloud2Ptr PointsMsg(new sensor_msgs::PointCloud2());
+    pcl::toROSMsg(*pc_map, *PointsMsg);
+    PointsMsg->header.stamp = pointcloud_time;
+    PointsMsg->header.frame_id = "map";
+    return PointsMsg;
+}
+
+void publish(const sensor_msgs::PointCloud2Ptr& PointsMsg)
+{
+    map_pub.publish(PointsMsg); 
+}
+
+//pose of an odometry message
+Eigen::Isometry3d poseFromOdometry(const nav_msgs::Odometry& odometry)
+{
+    Eigen::Isometry3d current_pose = Eigen::Isometry3d::Identity();
+    current_pose.rotate(Eigen::Quaterniond(odometry.pose.pose.orientation.w,odometry.pose.pose.orientation.x,odometry.pose.pose.orientation.y,odometry.pose.pose.orientation.z));  
+    current_pose.pretranslate(Eigen::Vector3d(odometry.pose.pose.position.x,odometry.pose.pose.position.y,odometry.pose.pose.position.z));
+    return current_pose;
+}
+
+//sleeps on the two queues until the odometry and the cloud of one frame are there
 void laser_mapping(){
+    sensor_msgs::PointCloud2ConstPtr pointcloud_msg;
+    nav_msgs::OdometryConstPtr odometry_msg;
+    std::chrono::steady_clock::time_point cloud_time, odometry_time;
     while(1){
-        if(!odometryBuf.empty() && !pointCloudBuf.empty()){
-
-            //read data
-            mutex_lock.lock();
-            if(!pointCloudBuf.empty() && pointCloudBuf.front()->header.stamp.toSec()<odometryBuf.front()->header.stamp.toSec()-0.5*lidar_param.scan_period){
-                ROS_WARN("time stamp unaligned error and pointcloud discarded, pls check your data --> laser mapping node"); 
-                pointCloudBuf.pop();
-                mutex_lock.unlock();
-                continue;              
-            }
-
-            if(!odometryBuf.empty() && odometryBuf.front()->header.stamp.toSec() < pointCloudBuf.front()->header.stamp.toSec()-0.5*lidar_param.scan_period){
-                odometryBuf.pop();
-                ROS_INFO("time stamp unaligned with path final, pls check your data --> laser mapping node");
-                mutex_lock.unlock();
-                continue;  
-            }
-
-            //if time aligned 
-            pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_in(new pcl::PointCloud<pcl::PointXYZI>());
-            pcl::fromROSMsg(*pointCloudBuf.front(), *pointcloud_in);
-            ros::Time pointcloud_time = (pointCloudBuf.front())->header.stamp;
-
-            Eigen::Isometry3d current_pose = Eigen::Isometry3d::Identity();
-            current_pose.rotate(Eigen::Quaterniond(odometryBuf.front()->pose.pose.orientation.w,odometryBuf.front()->pose.pose.orientation.x,odometryBuf.front()->pose.pose.orientation.y,odometryBuf.front()->pose.pose.orientation.z));  
-            current_pose.pretranslate(Eigen::Vector3d(odometryBuf.front()->pose.pose.position.x,odometryBuf.front()->pose.pose.position.y,odometryBuf.front()->pose.pose.position.z));
-            pointCloudBuf.pop();
-            odometryBuf.pop();
-            mutex_lock.unlock();
-            
-
-            laserMapping.updateCurrentPointsToMap(pointcloud_in,current_pose);
-
-            pcl::PointCloud<pcl::PointXYZI>::Ptr pc_map = laserMapping.getMap();
-            sensor_msgs::PointCloud2 PointsMsg;
-            pcl::toROSMsg(*pc_map, PointsMsg);
-            PointsMsg.header.stamp = pointcloud_time;
-            PointsMsg.header.frame_id = "map";
-            map_pub.publish(PointsMsg); 
-            
+        //read data, only the message dropped by the last alignment check is taken again
+        if(!odometry_msg && !odometryBuf.pop(odometry_msg, odometry_time))
+            break;
+        if(!pointcloud_msg && !pointCloudBuf.pop(pointcloud_msg, cloud_time))
+            break;
+
+        //the two queues drop on their own when full (queue_policy): the older side is popped again until the stamps agree
+        if(pointcloud_msg->header.stamp.toSec()<odometry_msg->header.stamp.toSec()-0.5*lidar_param.scan_period){
+            ROS_WARN("time stamp unaligned error and pointcloud discarded, pls check your data --> laser mapping node"); 
+            pointcloud_msg.reset();
+            continue;              
+        }
 
+        if(odometry_msg->header.stamp.toSec() < pointcloud_msg->header.stamp.toSec()-0.5*lidar_param.scan_period){
+            odometry_msg.reset();
+            ROS_INFO("time stamp unaligned with path final, pls check your data --> laser mapping node");
+            continue;  
+        }
 
+        //if time aligned 
+        size_t queue_depth = pointCloudBuf.size();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point ready = std::max(cloud_time, odometry_time);
+
+        //直接讀message的資料, 不轉成pcl點雲
+        PointCloud2View pointcloud_in(pointcloud_msg);
+        if(!pointcloud_in.valid()){
+            ROS_WARN("point cloud without float x/y/z fields, frame skipped, pls check your data --> laser mapping node");
+            pointcloud_msg.reset();
+            odometry_msg.reset();
+            continue;
+        }
+        ros::Time pointcloud_time = pointcloud_msg->header.stamp;
+        Eigen::Isometry3d current_pose = poseFromOdometry(*odometry_msg);
+
+        sensor_msgs::PointCloud2Ptr PointsMsg = processFrame(pointcloud_in, current_pose, pointcloud_time);
+        publish(PointsMsg);
+        pointcloud_msg.reset();
+        odometry_msg.reset();
+
+        stageStats.addFrame(queue_depth, StageStats::elapsedMs(ready, start), StageStats::elapsedMs(start, std::chrono::steady_clock::now()));
+        if(stageStats.frames() >= 100){
+            ROS_INFO("laser mapping stage: %s", stageStats.summary().c_str());
+            ROS_INFO("laser mapping latency: %s", stageStats.histogram().c_str());
+            stageStats.reset();
         }
-        //sleep 2 ms every time
-        std::chrono::milliseconds dura(2);
-        std::this_thread::sleep_for(dura);
     }
 }
 
-int main(int argc, char **argv)
+//parameters of the mapping stage
+void init(ros::NodeHandle& nh)
 {
-    ros::init(argc, argv, "main");
-    ros::NodeHandle nh;
 
     int scan_line = 64;
     double vertical_angle = 2.0;
@@ -125,13 +171,72 @@ int main(int argc, char **argv)
     lidar_param.setMinDistance(min_dis);
 
     laserMapping.init(map_resolution);
-    ros::Subscriber subLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>("/velodyne_points_filtered", 100, velodyneHandler);
-    ros::Subscriber subOdometry = nh.subscribe<nav_msgs::Odometry>("/odom", 100, odomCallback);
+}
 
+void advertise(ros::NodeHandle& nh)
+{
     map_pub = nh.advertise<sensor_msgs::PointCloud2>("/map", 100);
-    std::thread laser_mapping_process{laser_mapping};
+}
+
+//parameters, subscribers, publishers and the worker thread of the mapping stage
+//used by main() below and by the nodelet in floamNodelets.cpp
+bool setup(ros::NodeHandle& nh)
+{
+    //the stage state is namespace-global, a second setup in the same process would share it
+    if(is_setup.exchange(true)){
+        ROS_WARN("laser mapping stage is already running in this process, setup ignored");
+        return false;
+    }
+    init(nh);
+
+    //bounded inputs, 0: drop oldest, 1: block the subscriber, 2: keep latest, 3: skip new messages when full
+    int queue_capacity = 100;
+    int queue_policy = QUEUE_DROP_OLDEST;
+    nh.getParam("/queue_capacity", queue_capacity);
+    nh.getParam("/queue_policy", queue_policy);
+    if(queue_capacity < 1)
+        queue_capacity = 1;
+    odometryBuf.setCapacity(queue_capacity, (QueuePolicy)queue_policy);
+    pointCloudBuf.setCapacity(queue_capacity, (QueuePolicy)queue_policy);
+
+    queueDiagnostics.init(nh, "laser mapping");
+    diagnosticsTimer = nh.createTimer(ros::Duration(1.0), publishDiagnostics);
+
+    subLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>("/velodyne_points_filtered", 100, velodyneHandler);
+    subOdometry = nh.subscribe<nav_msgs::Odometry>("/odom", 100, odomCallback);
+
+    advertise(nh);
+    laser_mapping_process = std::thread(laser_mapping);
+    return true;
+}
+
+//close the input queues, the worker stops at the first queue found empty and is joined
+void shutdown()
+{
+    diagnosticsTimer.stop();
+    odometryBuf.close();
+    pointCloudBuf.close();
+    subLaserCloud.shutdown();
+    subOdometry.shutdown();
+    if(laser_mapping_process.joinable())
+        laser_mapping_process.join();
+}
+
+} // namespace laser_mapping_node
+
+#ifndef FLOAM_NO_MAIN
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "main");
+    ros::NodeHandle nh;
+
+    laser_mapping_node::setup(nh);
 
-    ros::spin();
+    //one thread per input plus the diagnostics timer, with QUEUE_BLOCK a callback waiting on a full queue must not hold back the other one
+    ros::MultiThreadedSpinner spinner(3);
+    spinner.spin();
 
+    laser_mapping_node::shutdown();
     return 0;
 }
+#endif
@@ -1,6 +1,7 @@
 
 #include "laserProcessingClass.h"
 #include "orbextractor.h"
+#include "planeKernel.h"
 #include <opencv2/highgui.hpp>
 #include <opencv2/opencv.hpp>
 #include <sensor_msgs/Image.h>
@@ -17,14 +18,32 @@
 
 
 //设置特征点提取需要的一些参数
-int nFeatures = 10000;//图像金字塔上特征点的数量
-int nLevels = 8;//图像金字塔层数
-float fScaleFactor = 1.2;//金字塔比例因子
-int fIniThFAST = 16; //检测fast角点阈值
-int fMinThFAST = 4; //最低阈值
-
-void LaserProcessingClass::init(lidar::Lidar lidar_param_in){
+static int nFeatures = 10000;//图像金字塔上特征点的数量
+static int nLevels = 8;//图像金字塔层数
+static float fScaleFactor = 1.2;//金字塔比例因子
+static int fIniThFAST = 16; //检测fast角点阈值
+static int fMinThFAST = 4; //最低阈值
+
+void LaserProcessingClass::init(lidar::Lidar lidar_param_in, int num_threads){
+    //the ring table is only built here, callers pass the parameters without it
     lidar_param = lidar_param_in;
+    lidar_param.buildRingTable();
+    threadPool.reset(new ThreadPool(num_threads));
+}
+
+const lidar::Lidar& LaserProcessingClass::lidarParam() const{
+    return lidar_param;
+}
+
+void LaserProcessingClass::setPlaneDetectMode(int mode_in){
+    plane_detect_mode = mode_in;
+}
+
+void LaserProcessingClass::setCameraCalibration(const Eigen::Matrix3d& result, const Eigen::Matrix3d& RR, const Eigen::Vector3d& tt){
+    //RR^-1 * (result * p - tt) = (RR^-1 * result) * p - RR^-1 * tt
+    Eigen::Matrix3d RR_inverse = RR.inverse();
+    backProjectionMatrix = RR_inverse * result;
+    backProjectionOffset = RR_inverse * tt;
 }
 
 
@@ -125,92 +144,184 @@ void processImageRegions_surface(const cv::Mat& depthImage, cv::Mat gray, int st
     }
 }
 
+// 同上 但一次算一整列 (SSE2/AVX2), 結果與上面完全相同
+void processImageRegions_surface_simd(const cv::Mat& depthImage, const cv::Mat& gray, int startY, int endY,
+ const PlaneKernelParams& params, std::vector<cv::Point>& planePixels) {
+    thread_local std::vector<int> plane_x;
+    if ((int)plane_x.size() < depthImage.cols) {
+        plane_x.resize(depthImage.cols);
+    }
+    for (int y = startY + params.half_window_size; y < endY - params.half_window_size; y++) {
+        int count = planeKernelRow(depthImage.data, depthImage.step, gray.data, gray.step, depthImage.cols, y, params, plane_x.data());
+        for (int i = 0; i < count; i++) {
+            planePixels.push_back(cv::Point(plane_x[i], y));
+        }
+    }
+}
+
+// 先算好每個像素x/y方向視窗的min/max (van Herk/Gil-Werman), 分類時只查表
+void processImageRegions_surface_separable(const cv::Mat& depthImage, const cv::Mat& gray, int startY, int endY,
+ const PlaneKernelParams& params, cv::Mat& windowMinX, cv::Mat& windowMaxX, cv::Mat& windowMinY, cv::Mat& windowMaxY,
+ std::vector<cv::Point>& planePixels) {
+    int h = params.half_window_size;
+    windowMinMaxX(depthImage.data, depthImage.step, depthImage.cols, startY + h, endY - h, h, windowMinX.data, windowMaxX.data, windowMinX.step);
+    windowMinMaxY(depthImage.data, depthImage.step, depthImage.cols, startY, endY, h, windowMinY.data, windowMaxY.data, windowMinY.step);
+
+    thread_local std::vector<int> plane_x;
+    if ((int)plane_x.size() < depthImage.cols) {
+        plane_x.resize(depthImage.cols);
+    }
+    for (int y = startY + h; y < endY - h; y++) {
+        int count = planeKernelRowSeparable(depthImage.data, depthImage.step, gray.data, gray.step,
+                                            windowMinX.data, windowMaxX.data, windowMinY.data, windowMaxY.data, windowMinX.step,
+                                            depthImage.cols, y, params, plane_x.data());
+        for (int i = 0; i < count; i++) {
+            planePixels.push_back(cv::Point(plane_x[i], y));
+        }
+    }
+}
+
+// 只檢查有雷達點投影到的像素 (hitPixels: 排序過的 y*cols+x)
+void processImageRegions_surface_sparse(const cv::Mat& depthImage, const cv::Mat& gray, int startY, int endY,
+ const PlaneKernelParams& params, const std::vector<int>& hitPixels, std::vector<cv::Point>& planePixels) {
+    int h = params.half_window_size;
+    if (endY - h <= startY + h) {
+        return;
+    }
+    auto begin = std::lower_bound(hitPixels.begin(), hitPixels.end(), (startY + h) * depthImage.cols);
+    auto end = std::lower_bound(begin, hitPixels.end(), (endY - h) * depthImage.cols);
+    for (auto it = begin; it != end; ++it) {
+        int y = *it / depthImage.cols;
+        int x = *it - y * depthImage.cols;
+        if (x < h || x >= depthImage.cols - h) {
+            continue;
+        }
+        if (planeKernelPixel(depthImage.data, depthImage.step, gray.data, gray.step, x, y, params)) {
+            planePixels.push_back(cv::Point(x, y));
+        }
+    }
+}
 
-void processImage_surface(const cv::Mat& depthImage,cv::Mat gray, int half_window_size,
+void processImage_surface(ThreadPool& pool, int mode, const cv::Mat& depthImage,cv::Mat gray, int half_window_size,
  double depth_threshold, double gradient_threshold , int intensity_threshold, int window_size,
-  std::vector<cv::Point>& planePixels) {
-    int numThreads = 16; // Number of threads to use
-    std::vector<std::thread> threads;
-    std::vector<std::vector<cv::Point>> planePixelsList(numThreads);
+  cv::Mat& windowMinX, cv::Mat& windowMaxX, cv::Mat& windowMinY, cv::Mat& windowMaxY,
+  const std::vector<int>& hitPixels, std::vector<std::vector<cv::Point>>& planePixelBands) {
+    // Row bands are fixed so the output does not depend on the pool size,
+    // the pool balances the sparse and the dense bands by work stealing
+    int numBands = 16;
+    std::vector<int> bandStart(numBands + 1);
+    if ((int)planePixelBands.size() != numBands) {
+        planePixelBands.resize(numBands);
+    }
 
-    // Split the image into regions and create threads
+    // Split the image into regions
     int totalHeight = depthImage.rows - depthImage.rows / 3.2; // Total height to process
-    int heightPerThread = totalHeight / numThreads;
-    int remainingHeight = totalHeight % numThreads;
+    int heightPerBand = totalHeight / numBands;
+    int remainingHeight = totalHeight % numBands;
     int startY = depthImage.rows / 3.2; // Start from one quarter of the image
-    for (int i = 0; i < numThreads; ++i) {
-        int endY = startY + heightPerThread;
-        if (i == numThreads - 1) endY += remainingHeight;
-        threads.emplace_back(processImageRegions_surface, std::cref(depthImage),gray, startY, endY, half_window_size, depth_threshold,gradient_threshold, intensity_threshold, window_size, std::ref(planePixelsList[i]));
-        startY = endY;
+    for (int i = 0; i < numBands; ++i) {
+        bandStart[i] = startY;
+        startY += heightPerBand;
     }
-
-    // Join threads
-    for (auto& thread : threads) {
-        thread.join();
+    bandStart[numBands] = startY + remainingHeight;
+
+    // Band buffers keep their capacity across frames, reserve the whole band once
+    for (int i = 0; i < numBands; ++i) {
+        size_t bandArea = (size_t)(bandStart[i + 1] - bandStart[i]) * depthImage.cols;
+        planePixelBands[i].clear();
+        if (planePixelBands[i].capacity() < bandArea) {
+            planePixelBands[i].reserve(bandArea);
+        }
     }
 
-    // Combine results from each thread if needed
-    for (const auto& pixels : planePixelsList) {
-        planePixels.insert(planePixels.end(), pixels.begin(), pixels.end());
+    // the integer kernels cannot express negative thresholds
+    PlaneKernelParams params;
+    if (mode != PLANE_DETECT_SCALAR && !makePlaneKernelParams(half_window_size, depth_threshold, gradient_threshold, intensity_threshold, params)) {
+        mode = PLANE_DETECT_SCALAR;
+    }
+    if (mode == PLANE_DETECT_SEPARABLE) {
+        // create() keeps the buffers while the image size does not change
+        windowMinX.create(depthImage.size(), CV_8UC1);
+        windowMaxX.create(depthImage.size(), CV_8UC1);
+        windowMinY.create(depthImage.size(), CV_8UC1);
+        windowMaxY.create(depthImage.size(), CV_8UC1);
     }
+
+    pool.parallelFor(numBands, [&](int i) {
+        if (mode == PLANE_DETECT_SIMD) {
+            processImageRegions_surface_simd(depthImage, gray, bandStart[i], bandStart[i + 1], params, planePixelBands[i]);
+        } else if (mode == PLANE_DETECT_SPARSE) {
+            processImageRegions_surface_sparse(depthImage, gray, bandStart[i], bandStart[i + 1], params, hitPixels, planePixelBands[i]);
+        } else if (mode == PLANE_DETECT_SEPARABLE) {
+            processImageRegions_surface_separable(depthImage, gray, bandStart[i], bandStart[i + 1], params, windowMinX, windowMaxX, windowMinY, windowMaxY, planePixelBands[i]);
+        } else {
+            processImageRegions_surface(depthImage, gray, bandStart[i], bandStart[i + 1], half_window_size, depth_threshold, gradient_threshold, intensity_threshold, window_size, planePixelBands[i]);
+        }
+    });
 }
 //====================================================
 //=====================================================
 
 void LaserProcessingClass::pointcloudtodepth(pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in,
-                                             sensor_msgs::ImageConstPtr& image_msg, 
+                                             FrameImageContext& image, 
                                              Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
-                                             Eigen::Matrix3d& result,
-                                             Eigen::Matrix3d& RR,
-                                             Eigen::Vector3d& tt,
                                              pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_first,
+                                             const ScanProjection& projection,
                                              pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_surf
                                              ){
-    cv_bridge::CvImagePtr cv_ptr;
-    cv_ptr = cv_bridge::toCvCopy(image_msg, sensor_msgs::image_encodings::BGR8);
-
-    cv::Mat gray;
-    cv::cvtColor(cv_ptr->image, gray, cv::COLOR_BGR2GRAY);
-
-    cv::Mat depthImage = cv::Mat::zeros(gray.size(), CV_8UC1);
-    cv::Mat depth_store = cv::Mat::zeros(gray.size(), CV_64FC1);
+    // 只用模糊後的灰階圖, 解碼與灰階在featureExtraction已經做過
+    const cv::Mat& gray = image.blurred();
+
+    // sparse模式: 深度圖跨frame保留, 只清掉這次投影到的像素
+    bool sparse = plane_detect_mode == PLANE_DETECT_SPARSE;
+    cv::Mat depthImage, depth_store;
+    if (sparse) {
+        if (sparseDepthImage.size() != gray.size()) {
+            sparseDepthImage = cv::Mat::zeros(gray.size(), CV_8UC1);
+            sparseDepthStore = cv::Mat::zeros(gray.size(), CV_64FC1);
+        }
+        depthImage = sparseDepthImage;
+        depth_store = sparseDepthStore;
+        hitPixels.clear();
+    } else {
+        depthImage = cv::Mat::zeros(gray.size(), CV_8UC1);
+        depth_store = cv::Mat::zeros(gray.size(), CV_64FC1);
+    }
 
     double scale = (double)87/256;
-    // double nani = 0;
+    // 投影在featureExtraction已經算好, surf點接在edge點後面
     for (int i = 0; i < (int) surf_first->points.size(); i++) {
-        if( surf_first->points[i].x > 0){
+        int k = projection.edge_count + i;
+        if (projection.valid[k]) {
             double t = surf_first->points[i].x / scale;
 
             if (t > 255) {
                 t = 255;
             }
 
-            Eigen::Vector4d curr_point(surf_first->points[i].x, surf_first->points[i].y, surf_first->points[i].z, 1);
-            Eigen::Vector3d curr_point_image = matrix_3Dto2D * curr_point;
-
-            curr_point_image.x() = curr_point_image.x() / curr_point_image.z();
-            curr_point_image.y() = curr_point_image.y() / curr_point_image.z();
-
-            int x = static_cast<int>(curr_point_image.x());
-            int y = static_cast<int>(curr_point_image.y());
-            if (x >= 0 && x < depthImage.cols && y >= 0 && y < depthImage.rows) {
-                depthImage.at<uchar>(y, x) = static_cast<uchar>(t);
-                depth_store.at<double>(y, x) = curr_point_image.z();
-                // nani++;
+            int x = projection.u[k];
+            int y = projection.v[k];
+            depthImage.at<uchar>(y, x) = static_cast<uchar>(t);
+            depth_store.at<double>(y, x) = projection.depth[k];
+            if (sparse) {
+                hitPixels.push_back(y * depthImage.cols + x);
             }
         }
     }
-    std::vector<cv::Point> planePixels;
+    if (sparse) {
+        // 排成row-major, 輸出順序跟dense掃描一樣
+        std::sort(hitPixels.begin(), hitPixels.end());
+        hitPixels.erase(std::unique(hitPixels.begin(), hitPixels.end()), hitPixels.end());
+    }
 
     //     double otsu_thresh_val = cv::threshold(  //0529
     //     gray, gray, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU
     // );
 
-    cv::Mat blurred , laplacian;
+    // cv::Mat blurred , laplacian;
     
-    // 使用高斯模糊
-    cv::GaussianBlur(gray, gray , cv::Size(3, 3), 1.0);
+    // 使用高斯模糊 (image.blurred())
+    // cv::GaussianBlur(gray, gray , cv::Size(3, 3), 1.0);
 
     // 計算拉普拉斯變換
     // cv::Laplacian(blurred, laplacian, CV_16S, 5);
@@ -230,48 +341,60 @@ void LaserProcessingClass::pointcloudtodepth(pcl::PointCloud<pcl::PointXYZI>::Pt
     double depth_threshold = 1.1;
     double gradient_threshold = 1.3;
 
-processImage_surface(depthImage,gray, half_window_size, depth_threshold, gradient_threshold, intensity_threshold, window_size, planePixels);
+processImage_surface(*threadPool, plane_detect_mode, depthImage,gray, half_window_size, depth_threshold, gradient_threshold, intensity_threshold, window_size,
+                     windowMinX, windowMaxX, windowMinY, windowMaxY, hitPixels, planePixelBands);
 
 
 
 
     //***********************先看深度值 再看強度值***********************   
 
-    for (const cv::Point& point : planePixels) {
+    // 有深度的平面像素 (x*d, y*d, d) 排成一個矩陣, 一次反投影回lidar座標
+    int plane_pixel_count = 0;
+    for (const std::vector<cv::Point>& band : planePixelBands)
+        plane_pixel_count += (int)band.size();
+    backProjectionPixels.resize(3, plane_pixel_count);
+
+    int depth_count = 0;
+    for (const std::vector<cv::Point>& band : planePixelBands) {
+    for (const cv::Point& point : band) {
         int x = point.x;
         int y = point.y;
         double depth_value = depth_store.at<double>(y, x); // 從深度圖像中獲取深度值，注意型態為double
         
         if(depth_value != 0){
-            Eigen::Vector3d points_3d(x*depth_value, y*depth_value, depth_value);
-            Eigen::Vector3d recover;
-            recover = RR.inverse() * (result*points_3d-tt);
-
-            pcl::PointXYZI pcl_point;
-            pcl_point.x = recover.x();
-            pcl_point.y = recover.y();
-            pcl_point.z = recover.z();
-            pc_out_surf->push_back(pcl_point);
-
-            // Eigen::Vector4d curr_point(recover.x(), recover.y(), recover.z(), 1);
-            // Eigen::Vector3d curr_point_image = matrix_3Dto2D * curr_point;
-
-            // curr_point_image.x() = curr_point_image.x() / curr_point_image.z();
-            // curr_point_image.y() = curr_point_image.y() / curr_point_image.z();
-
-            // int xx = static_cast<int>(curr_point_image.x());
-            // int yy = static_cast<int>(curr_point_image.y());
-
-            // if (xx >= 0 && xx < depthImage.cols && yy >= 0 && yy < depthImage.rows) {
-            //     cv::circle(cv_ptr->image, cv::Point(x, y), 1, cv::Scalar(0, 0, 255), -1);
-            // }
+            backProjectionPixels(0, depth_count) = x * depth_value;
+            backProjectionPixels(1, depth_count) = y * depth_value;
+            backProjectionPixels(2, depth_count) = depth_value;
+            depth_count++;
         }
     }
+    }
+
+    backProjectionPoints.noalias() = backProjectionMatrix * backProjectionPixels.leftCols(depth_count);
+    backProjectionPoints.colwise() -= backProjectionOffset;
+
+    size_t surf_begin = pc_out_surf->points.size();
+    pc_out_surf->resize(surf_begin + depth_count);
+    for (int i = 0; i < depth_count; i++) {
+        pcl::PointXYZI& pcl_point = pc_out_surf->points[surf_begin + i];
+        pcl_point.x = backProjectionPoints(0, i);
+        pcl_point.y = backProjectionPoints(1, i);
+        pcl_point.z = backProjectionPoints(2, i);
+        pcl_point.intensity = 0;
+    }
     double map_resolution = 0.3;
     downSizeFilterSurf.setLeafSize(map_resolution * 2, map_resolution * 2, map_resolution * 2);
     downSamplingToMap(pc_out_surf, pc_out_surf);
     std::cout << "after plane number = " << pc_out_surf->points.size() << std::endl;
 
+    if (sparse) {
+        for (int index : hitPixels) {
+            depthImage.data[index] = 0;
+            ((double*)depth_store.data)[index] = 0;
+        }
+    }
+
     // for (int i = 0; i < (int)pc_out_surf->points.size(); i++) {
     //     if (pc_out_surf->points[i].x >= 0) {
     //         Eigen::Vector4d curr_point(pc_out_surf->points[i].x, pc_out_surf->points[i].y, pc_out_surf->points[i].z, 1);
@@ -296,86 +419,151 @@ processImage_surface(depthImage,gray, half_window_size, depth_threshold, gradien
     // cv::waitKey(0);
 }
 
+void LaserProcessingClass::projectScan(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in,
+                                       const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in,
+                                       const Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
+                                       int cols, int rows,
+                                       ScanProjection& projection){
+    int edge_count = edge_in->points.size();
+    int total = edge_count + surf_in->points.size();
+    projection.edge_count = edge_count;
+    projection.surf_count = total - edge_count;
+    projection.u.resize(total);
+    projection.v.resize(total);
+    projection.depth.resize(total);
+    projection.valid.resize(total);
+
+    // 4xN的齊次座標只在點數變多時重新配置
+    if (projectionPoints.cols() < total) {
+        projectionPoints.resize(4, total);
+        projectionImage.resize(3, total);
+    }
+    for (int i = 0; i < total; i++) {
+        const pcl::PointXYZI& point = i < edge_count ? edge_in->points[i] : surf_in->points[i - edge_count];
+        projectionPoints(0, i) = point.x;
+        projectionPoints(1, i) = point.y;
+        projectionPoints(2, i) = point.z;
+        projectionPoints(3, i) = 1.0;
+    }
+    projectionImage.leftCols(total).noalias() = matrix_3Dto2D * projectionPoints.leftCols(total);
+
+    for (int i = 0; i < total; i++) {
+        double z = projectionImage(2, i);
+        int x = static_cast<int>(projectionImage(0, i) / z);
+        int y = static_cast<int>(projectionImage(1, i) / z);
+        // edge點取 x >= 0, surf點取 x > 0 (跟原本兩段各自投影時一樣)
+        double lidar_x = projectionPoints(0, i);
+        bool in_front = i < edge_count ? lidar_x >= 0 : lidar_x > 0;
+        projection.u[i] = x;
+        projection.v[i] = y;
+        projection.depth[i] = z;
+        projection.valid[i] = in_front && x >= 0 && x < cols && y >= 0 && y < rows;
+    }
+}
+
 void LaserProcessingClass::featureExtraction(pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, 
+                                             const std::vector<int>& point_rings,
                                              pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_edge, 
                                              pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_first,
-                                             sensor_msgs::ImageConstPtr& image_msg, 
-                                             Eigen::Matrix<double, 3, 4>& matrix_3Dto2D){
+                                             FrameImageContext& image, 
+                                             Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
+                                             ScanProjection& projection){
 
     std::vector<int> indices;
     pcl::removeNaNFromPointCloud(*pc_in, indices);
 
 
     int N_SCANS = lidar_param.num_lines;
-    std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> laserCloudScans;
-    for(int i=0;i<N_SCANS;i++){
-        laserCloudScans.push_back(pcl::PointCloud<pcl::PointXYZI>::Ptr(new pcl::PointCloud<pcl::PointXYZI>()));
+    prepareScans(N_SCANS);
+
+    //先算每個點的scan編號 (driver有ring欄位就直接用, 否則查lidar_param的elevation表), 再分到各scan
+    int point_count = (int)pc_in->points.size();
+    bool native_ring = (int)point_rings.size() == point_count;
+    pointRings.resize(point_count);
+    for (int i = 0; i < point_count; i++)
+    {
+        const pcl::PointXYZI& point = pc_in->points[i];
+        double distance = sqrt(point.x * point.x + point.y * point.y);
+        int scanID = native_ring ? point_rings[i] : lidar_param.ringFromTan(point.z / distance);
+        //NaN的點距離比較都是false, 一起丟掉
+        bool in_range = distance >= lidar_param.min_distance && distance <= lidar_param.max_distance;
+        pointRings[i] = (in_range && scanID < N_SCANS) ? scanID : -1;
     }
 
-    for (int i = 0; i < (int) pc_in->points.size(); i++)
+    for (int i = 0; i < point_count; i++)
     {
-        // if(pc_in->points[i].x >= 0){
-            int scanID=0;
-            double distance = sqrt(pc_in->points[i].x * pc_in->points[i].x + pc_in->points[i].y * pc_in->points[i].y);
-            if(distance<lidar_param.min_distance || distance>lidar_param.max_distance)
-                continue;
-            double angle = atan(pc_in->points[i].z / distance) * 180 / M_PI;
-            
-            // if (N_SCANS == 16)
-            // {
-            //     scanID = int((angle + 15) / 2 + 0.5);
-            //     if (scanID > (N_SCANS - 1) || scanID < 0)
-            //     {
-            //         continue;
-            //     }
-            // }
-            // else if (N_SCANS == 32)
-            // {
-            //     scanID = int((angle + 92.0/3.0) * 3.0 / 4.0);
-            //     if (scanID > (N_SCANS - 1) || scanID < 0)
-            //     {
-            //         continue;
-            //     }
-            // }
-            // else if (N_SCANS == 64)
-            // {   
-                if (angle >= -8.83)
-                    scanID = int((2 - angle) * 3.0 + 0.5);
-                else
-                    scanID = N_SCANS / 2 + int((-8.83 - angle) * 2.0 + 0.5);
-
-                if (angle > 2 || angle < -24.33 || scanID > 63 || scanID < 0)
-                {
-                    continue;
-                }
-            // }
-            // else
-            // {
-            //     printf("wrong scan number\n");
-            // } // cv::imshow("after", gray);
-    // cv::wa
-            laserCloudScans[scanID]->push_back(pc_in->points[i]); 
-        // }
+        if (pointRings[i] >= 0)
+            laserCloudScans[pointRings[i]]->push_back(pc_in->points[i]); 
+    }
+
+    featureExtractionFromScans(pc_out_edge, surf_first, image, matrix_3Dto2D, projection);
+}
+
+void LaserProcessingClass::featureExtraction(const RangeImage& range_image,
+                                             pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_edge, 
+                                             pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_first,
+                                             FrameImageContext& image, 
+                                             Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
+                                             ScanProjection& projection){
+    int N_SCANS = std::min(lidar_param.num_lines, range_image.rows);
+    prepareScans(N_SCANS);
+
+    //每一列就是一條scan, 依方位角順序把有值的格子接起來 (前後鄰居就是同一條scan上相鄰的點)
+    threadPool->parallelFor(N_SCANS, [&](int i) {
+        const pcl::PointXYZI* cells = range_image.cells.data() + (size_t)i * range_image.cols;
+        const unsigned char* valid = range_image.valid.data() + (size_t)i * range_image.cols;
+        std::vector<pcl::PointXYZI, Eigen::aligned_allocator<pcl::PointXYZI>>& scan = laserCloudScans[i]->points;
+        for (int col = 0; col < range_image.cols; col++) {
+            if (valid[col])
+                scan.push_back(cells[col]);
+        }
+        laserCloudScans[i]->width = (uint32_t)scan.size();
+        laserCloudScans[i]->height = 1;
+    });
+
+    featureExtractionFromScans(pc_out_edge, surf_first, image, matrix_3Dto2D, projection);
+}
+
+void LaserProcessingClass::prepareScans(int N_SCANS){
+    //scan的點雲留著重複用, 只清內容
+    while ((int)laserCloudScans.size() < N_SCANS) {
+        laserCloudScans.push_back(pcl::PointCloud<pcl::PointXYZI>::Ptr(new pcl::PointCloud<pcl::PointXYZI>()));
     }
+    for (int i = 0; i < (int)laserCloudScans.size(); i++) {
+        laserCloudScans[i]->clear();
+    }
+}
+
+void LaserProcessingClass::featureExtractionFromScans(pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_edge, 
+                                                      pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_first,
+                                                      FrameImageContext& image, 
+                                                      Eigen::Matrix<double, 3, 4>& matrix_3Dto2D,
+                                                      ScanProjection& projection){
+    int N_SCANS = std::min(lidar_param.num_lines, (int)laserCloudScans.size());
 
     pcl::PointCloud<pcl::PointXYZI>::Ptr edge_first(new pcl::PointCloud<pcl::PointXYZI>());
     // pcl::PointCloud<pcl::PointXYZI>::Ptr surf_first(new pcl::PointCloud<pcl::PointXYZI>());
 
-    for(int i = 0; i < N_SCANS; i++){
+    //每條scan各自算曲率和分段挑點, 結果先放在自己的buffer, 最後照scan順序合併 (跟thread數無關)
+    if ((int)ringCurvatureBuffers.size() < N_SCANS) {
+        ringCurvatureBuffers.resize(N_SCANS);
+        ringCurvature.resize(N_SCANS);
+        while ((int)ringEdge.size() < N_SCANS) {
+            ringEdge.push_back(pcl::PointCloud<pcl::PointXYZI>::Ptr(new pcl::PointCloud<pcl::PointXYZI>()));
+            ringSurf.push_back(pcl::PointCloud<pcl::PointXYZI>::Ptr(new pcl::PointCloud<pcl::PointXYZI>()));
+        }
+    }
+
+    threadPool->parallelFor(N_SCANS, [&](int i) {
+        ringEdge[i]->clear();
+        ringSurf[i]->clear();
         if(laserCloudScans[i]->points.size()<131){
-            continue;
+            return;
         }
         // std::cout << "laserCloudScans = " << laserCloudScans[i]->points.size() << std::endl;
-        std::vector<Double2d> cloudCurvature; 
+        std::vector<Double2d>& cloudCurvature = ringCurvature[i];
         int total_points = laserCloudScans[i]->points.size()-10;
-        for(int j = 5; j < (int)laserCloudScans[i]->points.size() - 5; j++){ //一個scan的每個點都算曲率
-            double diffX = laserCloudScans[i]->points[j - 5].x + laserCloudScans[i]->points[j - 4].x + laserCloudScans[i]->points[j - 3].x + laserCloudScans[i]->points[j - 2].x + laserCloudScans[i]->points[j - 1].x - 10 * laserCloudScans[i]->points[j].x + laserCloudScans[i]->points[j + 1].x + laserCloudScans[i]->points[j + 2].x + laserCloudScans[i]->points[j + 3].x + laserCloudScans[i]->points[j + 4].x + laserCloudScans[i]->points[j + 5].x;
-            double diffY = laserCloudScans[i]->points[j - 5].y + laserCloudScans[i]->points[j - 4].y + laserCloudScans[i]->points[j - 3].y + laserCloudScans[i]->points[j - 2].y + laserCloudScans[i]->points[j - 1].y - 10 * laserCloudScans[i]->points[j].y + laserCloudScans[i]->points[j + 1].y + laserCloudScans[i]->points[j + 2].y + laserCloudScans[i]->points[j + 3].y + laserCloudScans[i]->points[j + 4].y + laserCloudScans[i]->points[j + 5].y;
-            double diffZ = laserCloudScans[i]->points[j - 5].z + laserCloudScans[i]->points[j - 4].z + laserCloudScans[i]->points[j - 3].z + laserCloudScans[i]->points[j - 2].z + laserCloudScans[i]->points[j - 1].z - 10 * laserCloudScans[i]->points[j].z + laserCloudScans[i]->points[j + 1].z + laserCloudScans[i]->points[j + 2].z + laserCloudScans[i]->points[j + 3].z + laserCloudScans[i]->points[j + 4].z + laserCloudScans[i]->points[j + 5].z;
-            Double2d distance(j,diffX * diffX + diffY * diffY + diffZ * diffZ);
-            cloudCurvature.push_back(distance);
-
-        }
+        computeCurvature(laserCloudScans[i], ringCurvatureBuffers[i], cloudCurvature); //一個scan的每個點都算曲率
         for(int j=0;j<6;j++){
             int sector_length = (int)(total_points/6); //一個scan分成6段
             // std::cout << "sector_length = " << sector_length << std::endl;
@@ -384,20 +572,19 @@ void LaserProcessingClass::featureExtraction(pcl::PointCloud<pcl::PointXYZI>::Pt
             if (j==5){
                 sector_end = total_points - 1; 
             }
-            std::vector<Double2d> subCloudCurvature(cloudCurvature.begin()+sector_start,cloudCurvature.begin()+sector_end); 
-            
-            featureExtractionFromSector(laserCloudScans[i],subCloudCurvature, edge_first, surf_first);
+            featureExtractionFromSector(laserCloudScans[i], cloudCurvature, sector_start, sector_end, ringEdge[i], ringSurf[i]);
             // featureExtractionFromSector(laserCloudScans[i],subCloudCurvature, edge_first);
             
         }
+    });
 
+    for(int i = 0; i < N_SCANS; i++){
+        *edge_first += *ringEdge[i];
+        *surf_first += *ringSurf[i];
     }
 
-    cv_bridge::CvImagePtr cv_ptr;
-    cv_ptr = cv_bridge::toCvCopy(image_msg, sensor_msgs::image_encodings::BGR8);
-
-    cv::Mat gray;
-    cv::cvtColor(cv_ptr->image, gray, cv::COLOR_BGR2GRAY);
+    // Canny會改到影像, 用灰階圖的複本 (上面四分之一保留原本的灰階值)
+    cv::Mat gray = image.gray().clone();
 
     // 刪去上三分之一部分
     int third_rows = gray.rows / 4;
@@ -407,65 +594,54 @@ void LaserProcessingClass::featureExtraction(pcl::PointCloud<pcl::PointXYZI>::Pt
     Canny(gray_cropped, gray_cropped, 150, 100);
 
     // 用0（黑色）填補回去
-    cv::Mat gray_filled(gray.rows, gray.cols, gray.type(), cv::Scalar(0));
-    gray_cropped.copyTo(gray_filled(cv::Rect(0, third_rows, gray_cropped.cols, gray_cropped.rows)));
+    // cv::Mat gray_filled(gray.rows, gray.cols, gray.type(), cv::Scalar(0));
+    // gray_cropped.copyTo(gray_filled(cv::Rect(0, third_rows, gray_cropped.cols, gray_cropped.rows)));
     // cv::imshow("canny",gray_cropped);
     // cv::waitKey(0);
 
 
     int window_size = 3; // 可以根据需要调整
 
-    cv_bridge::CvImagePtr cv_ptr_2;
-    cv_ptr_2 = cv_bridge::toCvCopy(image_msg, sensor_msgs::image_encodings::BGR8);
-    
-
-
+    // edge與surf點一次投影完, pointcloudtodepth沿用surf那段
+    projectScan(edge_first, surf_first, matrix_3Dto2D, gray.cols, gray.rows, projection);
 
     // #pragma omp parallel for
     for (int i = 0; i < (int)edge_first->points.size(); i++) {
-        if (edge_first->points[i].x >= 0) {
-            
-            Eigen::Vector4d curr_point(edge_first->points[i].x, edge_first->points[i].y, edge_first->points[i].z, 1);
-            Eigen::Vector3d curr_point_image = matrix_3Dto2D * curr_point;
-
-            curr_point_image.x() = curr_point_image.x() / curr_point_image.z();
-            curr_point_image.y() = curr_point_image.y() / curr_point_image.z();
-
-            // 检查投影点是否在边缘上
-            int x = static_cast<int>(curr_point_image.x());
-            int y = static_cast<int>(curr_point_image.y());
-
-            if (x >= 0 && x < gray.cols && y >= 0 && y < gray.rows) {
-                // if (gray.at<uchar>(y, x) > 0) {
-                    // 检查周围像素是否是边缘
-                    bool is_edge_nearby = false;
-                    int half_window_size = window_size / 2;
-                    for (int dy = -half_window_size; dy <= half_window_size; dy++) {
-                        for (int dx = -half_window_size; dx <= half_window_size; dx++) {
-                            int nx = x + dx;
-                            int ny = y + dy;
-                            if (nx >= 0 && nx < gray.cols && ny >= 0 && ny < gray.rows) {
-                                if (gray.at<uchar>(ny, nx) > 0) {
-                                    is_edge_nearby = true;
-                                    break;
-                                }
+        if (projection.valid[i]) {
+            int x = projection.u[i];
+            int y = projection.v[i];
+
+            // if (gray.at<uchar>(y, x) > 0) {
+                // 检查周围像素是否是边缘
+                bool is_edge_nearby = false;
+                int half_window_size = window_size / 2;
+                for (int dy = -half_window_size; dy <= half_window_size; dy++) {
+                    for (int dx = -half_window_size; dx <= half_window_size; dx++) {
+                        int nx = x + dx;
+                        int ny = y + dy;
+                        if (nx >= 0 && nx < gray.cols && ny >= 0 && ny < gray.rows) {
+                            if (gray.at<uchar>(ny, nx) > 0) {
+                                is_edge_nearby = true;
+                                break;
                             }
                         }
-                        if (is_edge_nearby) {
-                            break;
-                        }
                     }
-
                     if (is_edge_nearby) {
-                        cv::circle(cv_ptr_2->image, cv::Point(x, y), 1, cv::Scalar(0, 0, 255), -1);
-                        // #pragma omp critical
-                        {
-                            pc_out_edge->push_back(edge_first->points[i]);
-                        }
-                        // number++;
+                        break;
                     }
-                // }
-            }
+                }
+
+                if (is_edge_nearby) {
+                    if (image.debug()) {
+                        cv::circle(image.debugImage(), cv::Point(x, y), 1, cv::Scalar(0, 0, 255), -1);
+                    }
+                    // #pragma omp critical
+                    {
+                        pc_out_edge->push_back(edge_first->points[i]);
+                    }
+                    // number++;
+                }
+            // }
         }
     }
     double map_resolution = 0.3;
@@ -473,59 +649,84 @@ void LaserProcessingClass::featureExtraction(pcl::PointCloud<pcl::PointXYZI>::Pt
     downSamplingToMap(pc_out_edge, pc_out_edge);
     std::cout << "after edge number = " << (int)pc_out_edge->points.size() << std::endl;
     
-    // cv::imshow("after edge", cv_ptr_2->image);
+    // cv::imshow("after edge", image.debugImage());
     // cv::waitKey(0);
 
 }
 
 
+void LaserProcessingClass::computeCurvature(const pcl::PointCloud<pcl::PointXYZI>::Ptr& scan_in,
+                                            ScanCurvatureBuffer& buffer,
+                                            std::vector<Double2d>& cloudCurvature){
+    //前後各5點減10倍自己, 跟原本一樣用float由左到右相加, 結果bit-for-bit相同
+    //沒有用O(1)的running sum/prefix sum: 會改變捨入, 0.1/5門檻附近的點分類可能不同, 所以每點仍是11項
+    //SoA的x/y/z連續存放, 每個j互相獨立, 編譯器可以向量化
+    int size = (int)scan_in->points.size();
+    buffer.x.resize(size);
+    buffer.y.resize(size);
+    buffer.z.resize(size);
+    for (int j = 0; j < size; j++) {
+        buffer.x[j] = scan_in->points[j].x;
+        buffer.y[j] = scan_in->points[j].y;
+        buffer.z[j] = scan_in->points[j].z;
+    }
+
+    cloudCurvature.clear();
+    if (size < 11)
+        return;
+    cloudCurvature.resize(size - 10, Double2d(0, 0));
+
+    const float* x = buffer.x.data();
+    const float* y = buffer.y.data();
+    const float* z = buffer.z.data();
+    Double2d* curvature = cloudCurvature.data();
+    for (int j = 5; j < size - 5; j++) {
+        double diffX = x[j - 5] + x[j - 4] + x[j - 3] + x[j - 2] + x[j - 1] - 10 * x[j] + x[j + 1] + x[j + 2] + x[j + 3] + x[j + 4] + x[j + 5];
+        double diffY = y[j - 5] + y[j - 4] + y[j - 3] + y[j - 2] + y[j - 1] - 10 * y[j] + y[j + 1] + y[j + 2] + y[j + 3] + y[j + 4] + y[j + 5];
+        double diffZ = z[j - 5] + z[j - 4] + z[j - 3] + z[j - 2] + z[j - 1] - 10 * z[j] + z[j + 1] + z[j + 2] + z[j + 3] + z[j + 4] + z[j + 5];
+        curvature[j - 5].id = j;
+        curvature[j - 5].value = diffX * diffX + diffY * diffY + diffZ * diffZ;
+    }
+}
+
 void LaserProcessingClass::featureExtractionFromSector(const pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, 
                                                              std::vector<Double2d>& cloudCurvature, 
+                                                             int sector_start, int sector_end,
                                                              pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_edge ,
                                                              pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_surf
                                                              ){
+    //跟原本一樣由小排到大再從後面往前走, 點輸出的順序也相同 (pointcloudtodepth同一個pixel以最後寫入的深度為準)
+    //sector裡的id都不重複, 原本picked_points的std::find一定找不到, 只留計數
+    std::vector<Double2d>::iterator begin = cloudCurvature.begin() + sector_start;
+    std::vector<Double2d>::iterator end = cloudCurvature.begin() + sector_end;
 
-    std::sort(cloudCurvature.begin(), cloudCurvature.end(), [](const Double2d & a, const Double2d & b)
+    std::sort(begin, end, [](const Double2d & a, const Double2d & b)
     { 
         return a.value < b.value; 
     }); //由小排到大
 
-
     int largestPickedNum = 0;
-    std::vector<int> picked_points;
-    int point_info_count =0;
-    for (int i = cloudCurvature.size()-1; i >= 0; i=i-1)
+    for (std::vector<Double2d>::iterator it = end; it != begin; )
     {
-        int ind = cloudCurvature[i].id; 
-        //檢查該點是否已經存在picked_points裡面 若不存在則執行if裡面的事
-        if(std::find(picked_points.begin(), picked_points.end(), ind)==picked_points.end()){
-
-            if(cloudCurvature[i].value > 0.1){
-                largestPickedNum++;
-                picked_points.push_back(ind);
-            }
-
-            //一個segment曲率前20大的都push進edge點
-            if (largestPickedNum <= 10 && cloudCurvature[i].value > 0.1 && std::abs(pc_in->points[ind].y) >= 0.5){
-                pc_out_edge->push_back(pc_in->points[ind]);
-                point_info_count++;
-            }
-            //若超過20個之後的點曲率還是大於5也是push進edge點
-            else if(cloudCurvature[i].value > 5 && std::abs(pc_in->points[ind].y) >= 0.5){
-                pc_out_edge->push_back(pc_in->points[ind]);
-                picked_points.push_back(ind);
-            }
-            else{
-                pc_out_surf->push_back(pc_in->points[ind]);
-            }
-
-            // if(std::abs(pc_in->points[i].y) >= 0.5)
-
+        --it;
+        int ind = it->id;
+        if(it->value > 0.1)
+            largestPickedNum++;
+        bool edge_candidate = std::abs(pc_in->points[ind].y) >= 0.5;
+
+        //一個segment曲率前10大的都push進edge點, 之後曲率還是大於5也是edge點
+        if (edge_candidate && ((largestPickedNum <= 10 && it->value > 0.1) || it->value > 5)) {
+            pc_out_edge->push_back(pc_in->points[ind]);
+        }
+        else{
+            pc_out_surf->push_back(pc_in->points[ind]);
         }
     }
 }
 LaserProcessingClass::LaserProcessingClass(){
-    
+    plane_detect_mode = PLANE_DETECT_SIMD;
+    backProjectionMatrix.setIdentity();
+    backProjectionOffset.setZero();
 }
 
 Double2d::Double2d(int id_in, double value_in){
@@ -5,9 +5,9 @@
 //c++ lib
 #include <cmath>
 #include <vector>
-#include <mutex>
-#include <queue>
+#include <cstring>
 #include <thread>
+#include <atomic>
 #include <chrono>
 
 //ros lib
@@ -26,6 +26,10 @@
 //local lib
 #include "lidar.h"
 #include "laserProcessingClass.h"
+#include "floamNodes.h"
+#include "blockingQueue.h"
+#include "stageStats.h"
+#include "queueDiagnostics.h"
 
 //後來加的
 #include <sensor_msgs/Image.h>
@@ -43,123 +47,238 @@
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 
+namespace laser_processing_node{
+
 LaserProcessingClass laserProcessing;
-std::mutex mutex_lock;
-std::queue<sensor_msgs::PointCloud2ConstPtr> pointCloudBuf;
-std::queue<sensor_msgs::ImageConstPtr> imageBuf;
+//cloud and image of one synchronized frame, queued together
+typedef std::pair<sensor_msgs::PointCloud2ConstPtr, sensor_msgs::ImageConstPtr> SyncedFrame;
+BlockingQueue<SyncedFrame> frameBuf;
+StageStats stageStats;
+QueueDiagnostics queueDiagnostics;
+ros::Timer diagnosticsTimer;
+std::thread laser_processing_process;
+std::atomic<bool> is_setup(false);
+
+//queue sizes and drop counters on /diagnostics once per second
+void publishDiagnostics(const ros::TimerEvent&)
+{
+    queueDiagnostics.addQueue("frames", frameBuf);
+    queueDiagnostics.publish();
+}
 lidar::Lidar lidar_param;
 
 ros::Publisher pubEdgePoints;
 ros::Publisher pubSurfPoints;
 ros::Publisher pubLaserCloudFiltered;
 ros::Publisher pubImage;
+ros::Publisher pubDebugImage;
+
+//camera and lidar are paired by approximate time, kept alive for the life of the stage
+typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::PointCloud2, sensor_msgs::Image> SyncPolicy;
+std::unique_ptr<message_filters::Subscriber<sensor_msgs::PointCloud2>> subLaserCloud;
+std::unique_ptr<message_filters::Subscriber<sensor_msgs::Image>> subImageLeft;
+std::unique_ptr<message_filters::Synchronizer<SyncPolicy>> sync;
 
 Eigen::Matrix<double, 3, 4> matrix_3Dto2D; //相乘的值
 Eigen::Matrix3d result;
 Eigen::Matrix3d RR;
 Eigen::Vector3d tt;
+ScanProjection scan_projection;
+int debug_visualization = 0;
+int use_ring_field = 1;
+std::vector<int> point_rings;
+
+//how the point cloud message is turned into scan lines
+enum IngestMode{
+    INGEST_CLOUD = 0,          //pcl::fromROSMsg then bin every point
+    INGEST_RANGE_IMAGE = 1     //reusable ring x azimuth image filled from the message buffer
+};
+int ingest_mode = INGEST_CLOUD;
+RangeImage range_image;
 
 void velodyneHandler(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg, const sensor_msgs::ImageConstPtr &laserImageMsg)
 {
-    mutex_lock.lock();
-    pointCloudBuf.push(laserCloudMsg);
-    imageBuf.push(laserImageMsg);
-    mutex_lock.unlock();
+    frameBuf.push(SyncedFrame(laserCloudMsg, laserImageMsg));
+}
+
+//ring of every point from the "ring" field of the driver, left empty if the cloud has no such field
+void readRingField(const sensor_msgs::PointCloud2& cloud_msg, std::vector<int>& rings)
+{
+    rings.clear();
+    for (const sensor_msgs::PointField& field : cloud_msg.fields) {
+        if (field.name != "ring")
+            continue;
+        int datatype = field.datatype;
+        if (datatype != sensor_msgs::PointField::UINT8 && datatype != sensor_msgs::PointField::UINT16
+            && datatype != sensor_msgs::PointField::INT16 && datatype != sensor_msgs::PointField::INT32
+            && datatype != sensor_msgs::PointField::UINT32)
+            return;
+        rings.resize((size_t)cloud_msg.width * cloud_msg.height);
+        size_t index = 0;
+        for (uint32_t row = 0; row < cloud_msg.height; row++) {
+            const uint8_t* data = cloud_msg.data.data() + (size_t)row * cloud_msg.row_step + field.offset;
+            for (uint32_t col = 0; col < cloud_msg.width; col++, data += cloud_msg.point_step) {
+                if (datatype == sensor_msgs::PointField::UINT8) {
+                    rings[index++] = *data;
+                } else if (datatype == sensor_msgs::PointField::UINT16) {
+                    uint16_t value;
+                    memcpy(&value, data, sizeof(value));
+                    rings[index++] = value;
+                } else if (datatype == sensor_msgs::PointField::INT16) {
+                    int16_t value;
+                    memcpy(&value, data, sizeof(value));
+                    rings[index++] = value;
+                } else {
+                    int32_t value;
+                    memcpy(&value, data, sizeof(value));
+                    rings[index++] = value;
+                }
+            }
+        }
+        return;
+    }
 }
 
 double total_time =0;
 int total_frame=0;
 
-void laser_processing(){
-    while(1){
-        if(!pointCloudBuf.empty() && !imageBuf.empty()){
-            //read data
-            mutex_lock.lock();
-            pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_in(new pcl::PointCloud<pcl::PointXYZI>());
-            pcl::fromROSMsg(*pointCloudBuf.front(), *pointcloud_in);
-            sensor_msgs::ImageConstPtr image_msg = imageBuf.front();
-
-            ros::Time pointcloud_time = (pointCloudBuf.front())->header.stamp;
-            pointCloudBuf.pop();
-            imageBuf.pop();
-            mutex_lock.unlock();
-
-            pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_edge(new pcl::PointCloud<pcl::PointXYZI>());          
-            pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_surf(new pcl::PointCloud<pcl::PointXYZI>());
-            pcl::PointCloud<pcl::PointXYZI>::Ptr surf_first(new pcl::PointCloud<pcl::PointXYZI>());
-
-            std::chrono::time_point<std::chrono::system_clock> start, end;
-            start = std::chrono::system_clock::now();
-            // laserProcessing.featureExtraction(pointcloud_in, pointcloud_edge, image_msg, matrix_3Dto2D);
-            laserProcessing.featureExtraction(pointcloud_in, pointcloud_edge, surf_first, image_msg, matrix_3Dto2D);
-            laserProcessing.pointcloudtodepth(pointcloud_in, image_msg, matrix_3Dto2D, result, RR, tt, surf_first, pointcloud_surf);
-            end = std::chrono::system_clock::now();
-            std::chrono::duration<float> elapsed_seconds = end - start;
-            total_frame++;
-            float time_temp = elapsed_seconds.count() * 1000;
-            total_time+=time_temp;
-            ROS_INFO("average laser processing time %f ms \n \n", total_time/total_frame);
-
-            sensor_msgs::PointCloud2 laserCloudFilteredMsg;
-            pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_filtered(new pcl::PointCloud<pcl::PointXYZI>());  
-            *pointcloud_filtered+=*pointcloud_edge;
-            *pointcloud_filtered+=*pointcloud_surf;
-            pcl::toROSMsg(*pointcloud_filtered, laserCloudFilteredMsg);
-            laserCloudFilteredMsg.header.stamp = pointcloud_time;
-            laserCloudFilteredMsg.header.frame_id = "base_link";
-            pubLaserCloudFiltered.publish(laserCloudFilteredMsg);
-
-            sensor_msgs::PointCloud2 edgePointsMsg;
-            pcl::toROSMsg(*pointcloud_edge, edgePointsMsg);
-            edgePointsMsg.header.stamp = pointcloud_time;
-            edgePointsMsg.header.frame_id = "base_link";
-            pubEdgePoints.publish(edgePointsMsg);
-
-            sensor_msgs::PointCloud2 surfPointsMsg;
-            pcl::toROSMsg(*pointcloud_surf, surfPointsMsg);
-            surfPointsMsg.header.stamp = pointcloud_time;
-            surfPointsMsg.header.frame_id = "base_link";
-            pubSurfPoints.publish(surfPointsMsg);
-
-            sensor_msgs::Image image_publish_msg = *image_msg;
-            image_publish_msg.header.stamp = pointcloud_time;  // 或者使用你需要的時間
-            image_publish_msg.header.frame_id = "base_link";  // 使用你需要的 frame_id
-            pubImage.publish(image_publish_msg);
+//features of one synchronized cloud/image pair, the clouds are the messages the stage publishes
+void processFrame(const sensor_msgs::PointCloud2ConstPtr& pointcloud_msg, const sensor_msgs::ImageConstPtr& image_msg, ProcessedFrame& frame)
+{
+    pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_in(new pcl::PointCloud<pcl::PointXYZI>());
+    if (ingest_mode != INGEST_RANGE_IMAGE) {
+        pcl::fromROSMsg(*pointcloud_msg, *pointcloud_in);
+        if (use_ring_field == 1)
+            readRingField(*pointcloud_msg, point_rings);
+    }
+    ros::Time pointcloud_time = pointcloud_msg->header.stamp;
+
+    pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_edge(new pcl::PointCloud<pcl::PointXYZI>());          
+    pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_surf(new pcl::PointCloud<pcl::PointXYZI>());
+    pcl::PointCloud<pcl::PointXYZI>::Ptr surf_first(new pcl::PointCloud<pcl::PointXYZI>());
+
+    std::chrono::time_point<std::chrono::system_clock> start, end;
+    start = std::chrono::system_clock::now();
+    // laserProcessing.featureExtraction(pointcloud_in, pointcloud_edge, image_msg, matrix_3Dto2D);
+    FrameImageContext image_context(image_msg, debug_visualization == 1);
+    if (ingest_mode == INGEST_RANGE_IMAGE && range_image.fill(PointCloud2View(pointcloud_msg), laserProcessing.lidarParam(), use_ring_field == 1)) {
+        laserProcessing.featureExtraction(range_image, pointcloud_edge, surf_first, image_context, matrix_3Dto2D, scan_projection);
+    } else {
+        if (ingest_mode == INGEST_RANGE_IMAGE)
+            pcl::fromROSMsg(*pointcloud_msg, *pointcloud_in);
+        laserProcessing.featureExtraction(pointcloud_in, point_rings, pointcloud_edge, surf_first, image_context, matrix_3Dto2D, scan_projection);
+    }
+    laserProcessing.pointcloudtodepth(pointcloud_in, image_context, matrix_3Dto2D, surf_first, scan_projection, pointcloud_surf);
+    end = std::chrono::system_clock::now();
+    std::chrono::duration<float> elapsed_seconds = end - start;
+    total_frame++;
+    float time_temp = elapsed_seconds.count() * 1000;
+    total_time+=time_temp;
+    ROS_INFO("average laser processing time %f ms \n \n", total_time/total_frame);
+
+    //shared pointers, inside one nodelet manager they are handed over without serialization
+    frame.filtered.reset(new sensor_msgs::PointCloud2());
+    pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_filtered(new pcl::PointCloud<pcl::PointXYZI>());  
+    *pointcloud_filtered+=*pointcloud_edge;
+    *pointcloud_filtered+=*pointcloud_surf;
+    pcl::toROSMsg(*pointcloud_filtered, *frame.filtered);
+    frame.filtered->header.stamp = pointcloud_time;
+    frame.filtered->header.frame_id = "base_link";
+
+    frame.edge.reset(new sensor_msgs::PointCloud2());
+    pcl::toROSMsg(*pointcloud_edge, *frame.edge);
+    frame.edge->header.stamp = pointcloud_time;
+    frame.edge->header.frame_id = "base_link";
+
+    frame.surf.reset(new sensor_msgs::PointCloud2());
+    pcl::toROSMsg(*pointcloud_surf, *frame.surf);
+    frame.surf->header.stamp = pointcloud_time;
+    frame.surf->header.frame_id = "base_link";
+
+    //影像改成點雲的stamp和base_link再轉發, odom用stamp跟edge/surf對齊
+    //每幀複製一次, 之後只傳指標
+    sensor_msgs::ImagePtr image_publish_msg(new sensor_msgs::Image(*image_msg));
+    image_publish_msg->header.stamp = pointcloud_time;
+    image_publish_msg->header.frame_id = "base_link";
+    frame.image = image_publish_msg;
+
+    //畫好edge點的影像發到/debug_image, 不在worker thread開視窗
+    if (image_context.debug())
+        frame.debug_image = cv_bridge::CvImage(image_publish_msg->header, sensor_msgs::image_encodings::BGR8, image_context.debugImage()).toImageMsg();
+}
+
+void publish(const ProcessedFrame& frame)
+{
+    pubLaserCloudFiltered.publish(frame.filtered);
+    pubEdgePoints.publish(frame.edge);
+    pubSurfPoints.publish(frame.surf);
+    pubImage.publish(frame.image);
+    if (frame.debug_image)
+        pubDebugImage.publish(frame.debug_image);
+}
 
+//sleeps on the queue until the next synchronized frame arrives
+void laser_processing(){
+    SyncedFrame input;
+    BlockingQueue<SyncedFrame>::Clock::time_point enqueued;
+    while(frameBuf.pop(input, enqueued)){
+        size_t queue_depth = frameBuf.size();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        ProcessedFrame frame;
+        processFrame(input.first, input.second, frame);
+        publish(frame);
+
+        stageStats.addFrame(queue_depth, StageStats::elapsedMs(enqueued, start), StageStats::elapsedMs(start, std::chrono::steady_clock::now()));
+        if(stageStats.frames() >= 100){
+            ROS_INFO("laser processing stage: %s", stageStats.summary().c_str());
+            ROS_INFO("laser processing latency: %s", stageStats.histogram().c_str());
+            stageStats.reset();
         }
-        //sleep 2 ms every time
-        std::chrono::milliseconds dura(2);
-        std::this_thread::sleep_for(dura);
     }
 }
 
-int main(int argc, char **argv)
+//parameters and camera calibration of the laser processing stage
+void init(ros::NodeHandle& nh)
 {
-    ros::init(argc, argv, "main");
-    ros::NodeHandle nh;
 
     int scan_line = 64;
     double vertical_angle = 2.0;
+    double vertical_angle_resolution = 0.0; //only for lidars other than 16/32/64 lines
     double scan_period= 0.1;
     double max_dis = 60.0;
     double min_dis = 2.0;
 
     int sequence_number = 4;
+    int num_threads = 0; //0: use hardware concurrency
+    int plane_detect_mode = PLANE_DETECT_SIMD;
+    int range_image_columns = 4096; //azimuth bins of INGEST_RANGE_IMAGE
 
     nh.getParam("/scan_period", scan_period); 
     nh.getParam("/vertical_angle", vertical_angle); 
+    nh.getParam("/vertical_angle_resolution", vertical_angle_resolution);
     nh.getParam("/max_dis", max_dis);
     nh.getParam("/min_dis", min_dis);
     nh.getParam("/scan_line", scan_line);
+    nh.getParam("/use_ring_field", use_ring_field);
+    nh.getParam("/ingest_mode", ingest_mode);
+    nh.getParam("/range_image_columns", range_image_columns);
     nh.getParam("/sequence_number", sequence_number);
+    nh.getParam("/num_threads", num_threads);
+    nh.getParam("/plane_detect_mode", plane_detect_mode);
+    nh.getParam("/debug_visualization", debug_visualization);
 
     lidar_param.setScanPeriod(scan_period);
     lidar_param.setVerticalAngle(vertical_angle);
+    lidar_param.setVerticalResolution(vertical_angle_resolution);
     lidar_param.setLines(scan_line);
     lidar_param.setMaxDistance(max_dis);
     lidar_param.setMinDistance(min_dis);
 
-    laserProcessing.init(lidar_param);
+    laserProcessing.init(lidar_param, num_threads);
+    laserProcessing.setPlaneDetectMode(plane_detect_mode);
+    if (ingest_mode == INGEST_RANGE_IMAGE)
+        range_image.init(scan_line, range_image_columns);
 
     // ros::Subscriber subLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>("/velodyne_points", 100, velodyneHandler);
     // ros::Subscriber subImageLeft = nh.subscribe<sensor_msgs::Image>("/image_left", 100, imageLeftHandler);
@@ -252,23 +371,79 @@ int main(int argc, char **argv)
         matrix_3Dto2D = Project_matrix * rotation_matrix * transformation_matrix;
     }
 
+    laserProcessing.setCameraCalibration(result, RR, tt);
+}
 
-    message_filters::Subscriber<sensor_msgs::PointCloud2> subLaserCloud(nh , "/velodyne_points", 100);
-    message_filters::Subscriber<sensor_msgs::Image> subImageLeft(nh, "/image_left", 100);
-
-    typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::PointCloud2, sensor_msgs::Image> SyncPolicy;
-    message_filters::Synchronizer<SyncPolicy> sync(SyncPolicy(30), subLaserCloud, subImageLeft);
-
-    sync.registerCallback(boost::bind(&velodyneHandler, _1, _2));
-
+void advertise(ros::NodeHandle& nh)
+{
     pubLaserCloudFiltered = nh.advertise<sensor_msgs::PointCloud2>("/velodyne_points_filtered", 100);
     pubEdgePoints = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_edge", 100);
     pubSurfPoints = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_surf", 100); 
     pubImage = nh.advertise<sensor_msgs::Image>("/processed_image", 100);
+    pubDebugImage = nh.advertise<sensor_msgs::Image>("/debug_image", 10);
+}
+
+//parameters, subscribers, publishers and the worker thread of the laser processing stage
+//used by main() below and by the nodelet in floamNodelets.cpp
+bool setup(ros::NodeHandle& nh)
+{
+    //the stage state is namespace-global, a second setup in the same process would share it
+    if(is_setup.exchange(true)){
+        ROS_WARN("laser processing stage is already running in this process, setup ignored");
+        return false;
+    }
+    init(nh);
+
+    //bounded input, 0: drop oldest, 1: block the subscriber, 2: keep latest, 3: skip new frames when full
+    int queue_capacity = 100;
+    int queue_policy = QUEUE_DROP_OLDEST;
+    nh.getParam("/queue_capacity", queue_capacity);
+    nh.getParam("/queue_policy", queue_policy);
+    if(queue_capacity < 1)
+        queue_capacity = 1;
+    frameBuf.setCapacity(queue_capacity, (QueuePolicy)queue_policy);
+
+    queueDiagnostics.init(nh, "laser processing");
+    diagnosticsTimer = nh.createTimer(ros::Duration(1.0), publishDiagnostics);
+
+    subLaserCloud.reset(new message_filters::Subscriber<sensor_msgs::PointCloud2>(nh , "/velodyne_points", 100));
+    subImageLeft.reset(new message_filters::Subscriber<sensor_msgs::Image>(nh, "/image_left", 100));
+
+    sync.reset(new message_filters::Synchronizer<SyncPolicy>(SyncPolicy(30), *subLaserCloud, *subImageLeft));
+
+    sync->registerCallback(boost::bind(&velodyneHandler, _1, _2));
+
+    advertise(nh);
 
-    std::thread laser_processing_process{laser_processing};
+    laser_processing_process = std::thread(laser_processing);
+    return true;
+}
+
+//close the input queue, the worker finishes the queued frames and is joined
+void shutdown()
+{
+    diagnosticsTimer.stop();
+    //closed first, a callback blocked in push (QUEUE_BLOCK) returns and the subscribers can be dropped
+    frameBuf.close();
+    subLaserCloud->unsubscribe();
+    subImageLeft->unsubscribe();
+    if(laser_processing_process.joinable())
+        laser_processing_process.join();
+}
+
+} // namespace laser_processing_node
+
+#ifndef FLOAM_NO_MAIN
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "main");
+    ros::NodeHandle nh;
+
+    laser_processing_node::setup(nh);
 
     ros::spin();
 
+    laser_processing_node::shutdown();
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -4,9 +4,16 @@
 
 #include "lidar.h"
 
+#include <cmath>
+#include <cstdio>
+
 
 lidar::Lidar::Lidar(){
- 
+    num_lines = 64;
+    vertical_angle = 2.0;
+    vertical_angle_resolution = 0.0;
+    ring_table_min = 0.0;
+    ring_table_inverse_step = 0.0;
 }
 
 
@@ -36,4 +43,60 @@ void lidar::Lidar::setMaxDistance(double max_distance_in){
 
 void lidar::Lidar::setMinDistance(double min_distance_in){
 	min_distance = min_distance_in;
-}
\ No newline at end of file
+}
+
+int lidar::Lidar::ringFromAngle(double angle) const{
+    int scanID = 0;
+    if (num_lines == 16)
+    {
+        scanID = int((angle + 15) / 2 + 0.5);
+    }
+    else if (num_lines == 32)
+    {
+        scanID = int((angle + 92.0/3.0) * 3.0 / 4.0);
+    }
+    else if (num_lines == 64)
+    {   
+        //HDL-64E: upper block 1/3 degree, lower block 1/2 degree
+        if (angle >= -8.83)
+            scanID = int((2 - angle) * 3.0 + 0.5);
+        else
+            scanID = num_lines / 2 + int((-8.83 - angle) * 2.0 + 0.5);
+
+        if (angle > 2 || angle < -24.33)
+            return -1;
+    }
+    else
+    {
+        //evenly spaced rings, ring 0 at vertical_angle
+        if (vertical_angle_resolution <= 0)
+            return -1;
+        scanID = int((vertical_angle - angle) / vertical_angle_resolution + 0.5);
+    }
+    if (scanID > (num_lines - 1) || scanID < 0)
+        return -1;
+    return scanID;
+}
+
+void lidar::Lidar::buildRingTable(){
+    //cells over tan(elevation) in [-tan(60), tan(60)], about 0.012 degree each
+    const int table_size = 16384;
+    const double tan_max = std::tan(60.0 * M_PI / 180.0);
+    double step = 2 * tan_max / table_size;
+    ring_table_min = -tan_max;
+    ring_table_inverse_step = 1.0 / step;
+    ring_table.assign(table_size, -1);
+
+    if (num_lines != 16 && num_lines != 32 && num_lines != 64 && vertical_angle_resolution <= 0)
+        printf("wrong scan number, set vertical_angle_resolution for a %d line lidar\n", num_lines);
+
+    //the ring is monotonic in the elevation, so a cell has one ring if both (slightly widened) borders agree
+    double margin = step * 1e-3;
+    for (int i = 0; i < table_size; i++) {
+        double tan_begin = ring_table_min + i * step - margin;
+        double tan_end = ring_table_min + (i + 1) * step + margin;
+        int ring_begin = ringFromAngle(std::atan(tan_begin) * 180 / M_PI);
+        int ring_end = ringFromAngle(std::atan(tan_end) * 180 / M_PI);
+        ring_table[i] = ring_begin == ring_end ? (short)ring_begin : (short)-2;
+    }
+}
@@ -14,29 +14,16 @@ bool EdgeAnalyticCostFunction::Evaluate(double const *const *parameters, double
     
     Eigen::Map<const Eigen::Quaterniond> q_last_curr(parameters[0]);
     Eigen::Map<const Eigen::Vector3d> t_last_curr(parameters[0] + 4);
-    Eigen::Vector3d lp;
-    lp = q_last_curr * curr_point + t_last_curr; 
-
-    Eigen::Vector3d nu = (lp - last_point_a).cross(lp - last_point_b);
-    Eigen::Vector3d de = last_point_a - last_point_b;
-    double de_norm = de.norm();
-    residuals[0] = nu.norm()/de_norm;
-    
-    if(jacobians != NULL)
+    if(jacobians != NULL && jacobians[0] != NULL)
     {
-        if(jacobians[0] != NULL)
-        {
-            Eigen::Matrix3d skew_lp = skew(lp);
-            Eigen::Matrix<double, 3, 6> dp_by_se3;
-            dp_by_se3.block<3,3>(0,0) = -skew_lp;
-            (dp_by_se3.block<3,3>(0, 3)).setIdentity();
-            Eigen::Map<Eigen::Matrix<double, 1, 7, Eigen::RowMajor> > J_se3(jacobians[0]);
-            J_se3.setZero();
-            Eigen::Matrix3d skew_de = skew(de);
-            J_se3.block<1,6>(0,0) = - nu.transpose() / nu.norm() * skew_de * dp_by_se3/de_norm;
-      
-        }
-    }  
+        Eigen::Matrix<double, 1, 6> jacobian;
+        residuals[0] = edgeResidual(q_last_curr, t_last_curr, curr_point, last_point_a, last_point_b, &jacobian);
+        Eigen::Map<Eigen::Matrix<double, 1, 7, Eigen::RowMajor> > J_se3(jacobians[0]);
+        J_se3.setZero();
+        J_se3.block<1,6>(0,0) = jacobian;
+    }
+    else
+        residuals[0] = edgeResidual(q_last_curr, t_last_curr, curr_point, last_point_a, last_point_b, NULL);
 
     return true;
  
@@ -52,26 +39,62 @@ bool SurfNormAnalyticCostFunction::Evaluate(double const *const *parameters, dou
 {
     Eigen::Map<const Eigen::Quaterniond> q_w_curr(parameters[0]);
     Eigen::Map<const Eigen::Vector3d> t_w_curr(parameters[0] + 4);
-    Eigen::Vector3d point_w = q_w_curr * curr_point + t_w_curr;
-    residuals[0] = plane_unit_norm.dot(point_w) + negative_OA_dot_norm;
+    if(jacobians != NULL && jacobians[0] != NULL)
+    {
+        Eigen::Matrix<double, 1, 6> jacobian;
+        residuals[0] = surfResidual(q_w_curr, t_w_curr, curr_point, plane_unit_norm, negative_OA_dot_norm, &jacobian);
+        Eigen::Map<Eigen::Matrix<double, 1, 7, Eigen::RowMajor> > J_se3(jacobians[0]);
+        J_se3.setZero();
+        J_se3.block<1,6>(0,0) = jacobian;
+    }
+    else
+        residuals[0] = surfResidual(q_w_curr, t_w_curr, curr_point, plane_unit_norm, negative_OA_dot_norm, NULL);
+    return true;
 
-    if(jacobians != NULL)
+}   
+
+double edgeResidual(const Eigen::Quaterniond& q, const Eigen::Vector3d& t, const Eigen::Vector3d& curr_point,
+                    const Eigen::Vector3d& point_a, const Eigen::Vector3d& point_b, Eigen::Matrix<double, 1, 6>* jacobian)
+{
+    Eigen::Vector3d lp = q * curr_point + t;
+    Eigen::Vector3d nu = (lp - point_a).cross(lp - point_b);
+    Eigen::Vector3d de = point_a - point_b;
+    double de_norm = de.norm();
+    double nu_norm = nu.norm();
+
+    if(jacobian != NULL)
     {
-        if(jacobians[0] != NULL)
+        //point exactly on the line: the gradient of the distance is not defined
+        if(nu_norm < 1e-12)
+            jacobian->setZero();
+        else
         {
-            Eigen::Matrix3d skew_point_w = skew(point_w);
+            Eigen::Matrix3d skew_lp = skew(lp);
             Eigen::Matrix<double, 3, 6> dp_by_se3;
-            dp_by_se3.block<3,3>(0,0) = -skew_point_w;
+            dp_by_se3.block<3,3>(0,0) = -skew_lp;
             (dp_by_se3.block<3,3>(0, 3)).setIdentity();
-            Eigen::Map<Eigen::Matrix<double, 1, 7, Eigen::RowMajor> > J_se3(jacobians[0]);
-            J_se3.setZero();
-            J_se3.block<1,6>(0,0) = plane_unit_norm.transpose() * dp_by_se3;
-   
+            Eigen::Matrix3d skew_de = skew(de);
+            *jacobian = - nu.transpose() / nu_norm * skew_de * dp_by_se3/de_norm;
         }
     }
-    return true;
+    return nu_norm/de_norm;
+}
 
-}   
+double surfResidual(const Eigen::Quaterniond& q, const Eigen::Vector3d& t, const Eigen::Vector3d& curr_point,
+                    const Eigen::Vector3d& plane_unit_norm, double negative_OA_dot_norm, Eigen::Matrix<double, 1, 6>* jacobian)
+{
+    Eigen::Vector3d point_w = q * curr_point + t;
+
+    if(jacobian != NULL)
+    {
+        Eigen::Matrix3d skew_point_w = skew(point_w);
+        Eigen::Matrix<double, 3, 6> dp_by_se3;
+        dp_by_se3.block<3,3>(0,0) = -skew_point_w;
+        (dp_by_se3.block<3,3>(0, 3)).setIdentity();
+        *jacobian = plane_unit_norm.transpose() * dp_by_se3;
+    }
+    return plane_unit_norm.dot(point_w) + negative_OA_dot_norm;
+}
 
 #if CERES_VERSION_MAJOR >= 3 || (CERES_VERSION_MAJOR >= 2 && CERES_VERSION_MINOR >= 1)
 bool PoseSE3Parameterization::Plus(const double *x, const double *delta, double *x_plus_delta) const
@@ -5,6 +5,8 @@
 #include "odomEstimationClass.h"
 #include "orbextractor.h"
 #include <iostream>
+#include <algorithm>
+#include <limits>
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
 #include <opencv2/opencv.hpp>
@@ -21,14 +23,14 @@ int frame_count = 0;
 int frame_start_repro = 10;
 
 //设置特征点提取需要的一些参数
-int nFeatures = 500;//图像金字塔上特征点的数量
-int nLevels = 8;//图像金字塔层数
-float fScaleFactor = 1.2;//金字塔比例因子
-int fIniThFAST = 20; //检测fast角点阈值
-int fMinThFAST = 8; //最低阈值
+static int nFeatures = 500;//图像金字塔上特征点的数量
+static int nLevels = 8;//图像金字塔层数
+static float fScaleFactor = 1.2;//金字塔比例因子
+static int fIniThFAST = 20; //检测fast角点阈值
+static int fMinThFAST = 8; //最低阈值
 
 
-void OdomEstimationClass::init(lidar::Lidar lidar_param, double map_resolution){
+void OdomEstimationClass::init(lidar::Lidar lidar_param, double map_resolution, int num_threads){
     //init local map
     laserCloudCornerMap = pcl::PointCloud<pcl::PointXYZI>::Ptr(new pcl::PointCloud<pcl::PointXYZI>());
     laserCloudSurfMap = pcl::PointCloud<pcl::PointXYZI>::Ptr(new pcl::PointCloud<pcl::PointXYZI>());
@@ -41,6 +43,22 @@ void OdomEstimationClass::init(lidar::Lidar lidar_param, double map_resolution){
     kdtreeEdgeMap = pcl::KdTreeFLANN<pcl::PointXYZI>::Ptr(new pcl::KdTreeFLANN<pcl::PointXYZI>());
     kdtreeSurfMap = pcl::KdTreeFLANN<pcl::PointXYZI>::Ptr(new pcl::KdTreeFLANN<pcl::PointXYZI>());
 
+    //incremental kd-tree, same resolution as the downsampling of the point cloud map
+    map_backend = MAP_BACKEND_FLANN;
+    ikdtreeEdgeMap.setDownsampleResolution(map_resolution);
+    ikdtreeSurfMap.setDownsampleResolution(map_resolution * 2);
+    //voxel hash map: 1 m voxels cover the 1 m radius a correspondence is accepted in (pointSearchSqDis[4] < 1.0)
+    voxelMapEdge.setResolution(1.0, map_resolution);
+    voxelMapSurf.setResolution(1.0, map_resolution * 2);
+
+    //correspondence search
+    threadPool.reset(new ThreadPool(num_threads));
+
+    //solver
+    solver_mode = SOLVER_CERES;
+    reassociation_threshold = 0.05;
+    huberLoss.reset(new ceres::HuberLoss(0.1));
+
     odom = Eigen::Isometry3d::Identity();
     last_odom = Eigen::Isometry3d::Identity();
     total = Eigen::Isometry3d::Identity();
@@ -48,15 +66,63 @@ void OdomEstimationClass::init(lidar::Lidar lidar_param, double map_resolution){
     optimization_count=2;
 }
 
+void OdomEstimationClass::setMapBackend(int backend_in){
+    map_backend = backend_in;
+}
+
+void OdomEstimationClass::setSolverMode(int mode_in){
+    solver_mode = mode_in;
+}
+
+void OdomEstimationClass::setReassociationThreshold(double threshold_in){
+    reassociation_threshold = threshold_in;
+}
+
 void OdomEstimationClass::initMapWithPoints(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in){
-    *laserCloudCornerMap += *edge_in;
-    *laserCloudSurfMap += *surf_in;
+    if(map_backend == MAP_BACKEND_IKD_TREE){
+        ikdtreeEdgeMap.addPoints(*edge_in);
+        ikdtreeSurfMap.addPoints(*surf_in);
+    }else if(map_backend == MAP_BACKEND_VOXEL_HASH){
+        voxelMapEdge.addPoints(*edge_in);
+        voxelMapSurf.addPoints(*surf_in);
+    }else{
+        *laserCloudCornerMap += *edge_in;
+        *laserCloudSurfMap += *surf_in;
+    }
     optimization_count=12;
 }
 
+void OdomEstimationClass::initMapWithPoints(const PointCloud2View& edge_in, const PointCloud2View& surf_in){
+    pcl::PointCloud<pcl::PointXYZI>::Ptr edge_cloud(new pcl::PointCloud<pcl::PointXYZI>());
+    pcl::PointCloud<pcl::PointXYZI>::Ptr surf_cloud(new pcl::PointCloud<pcl::PointXYZI>());
+    for (size_t i = 0; i < edge_in.size(); i++)
+        edge_cloud->push_back(edge_in.point(i));
+    for (size_t i = 0; i < surf_in.size(); i++)
+        surf_cloud->push_back(surf_in.point(i));
+    initMapWithPoints(edge_cloud, surf_cloud);
+}
+
 double number = 0;
 void OdomEstimationClass::updatePointsToMap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in
                                           , const sensor_msgs::ImageConstPtr& image_in, const int sequence_number){
+    pcl::PointCloud<pcl::PointXYZI>::Ptr downsampledEdgeCloud(new pcl::PointCloud<pcl::PointXYZI>());
+    pcl::PointCloud<pcl::PointXYZI>::Ptr downsampledSurfCloud(new pcl::PointCloud<pcl::PointXYZI>());
+    downSamplingToMap(edge_in,downsampledEdgeCloud,surf_in,downsampledSurfCloud);
+    updateDownsampledPointsToMap(downsampledEdgeCloud, downsampledSurfCloud, image_in, sequence_number);
+}
+
+void OdomEstimationClass::updatePointsToMap(const PointCloud2View& edge_in, const PointCloud2View& surf_in
+                                          , const sensor_msgs::ImageConstPtr& image_in, const int sequence_number){
+    //只有降採樣後的點才變成pcl點雲
+    pcl::PointCloud<pcl::PointXYZI>::Ptr downsampledEdgeCloud(new pcl::PointCloud<pcl::PointXYZI>());
+    pcl::PointCloud<pcl::PointXYZI>::Ptr downsampledSurfCloud(new pcl::PointCloud<pcl::PointXYZI>());
+    downSizeFilterEdge.filter(edge_in, *downsampledEdgeCloud);
+    downSizeFilterSurf.filter(surf_in, *downsampledSurfCloud);
+    updateDownsampledPointsToMap(downsampledEdgeCloud, downsampledSurfCloud, image_in, sequence_number);
+}
+
+void OdomEstimationClass::updateDownsampledPointsToMap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& downsampledEdgeCloud, const pcl::PointCloud<pcl::PointXYZI>::Ptr& downsampledSurfCloud
+                                                     , const sensor_msgs::ImageConstPtr& image_in, const int sequence_number){
 
     if(optimization_count>2)
         optimization_count--;
@@ -80,35 +146,29 @@ void OdomEstimationClass::updatePointsToMap(const pcl::PointCloud<pcl::PointXYZI
     t_w_change.y() = -t_w_curr.z();
     t_w_change.z() =  t_w_curr.x();
 
-    pcl::PointCloud<pcl::PointXYZI>::Ptr downsampledEdgeCloud(new pcl::PointCloud<pcl::PointXYZI>());
-    pcl::PointCloud<pcl::PointXYZI>::Ptr downsampledSurfCloud(new pcl::PointCloud<pcl::PointXYZI>());
-    downSamplingToMap(edge_in,downsampledEdgeCloud,surf_in,downsampledSurfCloud);
     //ROS_WARN("point nyum%d,%d",(int)downsampledEdgeCloud->points.size(), (int)downsampledSurfCloud->points.size());
-    if(laserCloudCornerMap->points.size()>10 && laserCloudSurfMap->points.size()>50){
-        kdtreeEdgeMap->setInputCloud(laserCloudCornerMap);
-        kdtreeSurfMap->setInputCloud(laserCloudSurfMap);
-
-        for (int iterCount = 0; iterCount < optimization_count; iterCount++){
-            ceres::LossFunction *loss_function = new ceres::HuberLoss(0.1);
-            ceres::Problem::Options problem_options;
-            ceres::Problem problem(problem_options);
-
-            problem.AddParameterBlock(parameters, 7, new PoseSE3Parameterization());
-
-            addEdgeCostFactor(downsampledEdgeCloud,laserCloudCornerMap,problem,loss_function);
-            addSurfCostFactor(downsampledSurfCloud,laserCloudSurfMap,problem,loss_function);
-
-            ceres::Solver::Options options;
-            options.linear_solver_type = ceres::DENSE_QR;
-            options.max_num_iterations = 4;
-            options.minimizer_progress_to_stdout = false;
-            options.check_gradients = false;
-            options.gradient_check_relative_precision = 1e-4;
-            ceres::Solver::Summary summary;
-
-            ceres::Solve(options, &problem, &summary);
-
+    int edge_map_size = (int)laserCloudCornerMap->points.size();
+    int surf_map_size = (int)laserCloudSurfMap->points.size();
+    if(map_backend == MAP_BACKEND_IKD_TREE){
+        edge_map_size = ikdtreeEdgeMap.size();
+        surf_map_size = ikdtreeSurfMap.size();
+    }else if(map_backend == MAP_BACKEND_VOXEL_HASH){
+        edge_map_size = voxelMapEdge.size();
+        surf_map_size = voxelMapSurf.size();
+    }
+    if(edge_map_size>10 && surf_map_size>50){
+        //the incremental trees and the voxel maps are already up to date
+        if(map_backend == MAP_BACKEND_FLANN){
+            kdtreeEdgeMap->setInputCloud(laserCloudCornerMap);
+            kdtreeSurfMap->setInputCloud(laserCloudSurfMap);
         }
+
+        if(solver_mode == SOLVER_CERES_REUSE)
+            solveCeresReuse(downsampledEdgeCloud, downsampledSurfCloud);
+        else if(solver_mode == SOLVER_GAUSS_NEWTON)
+            solveGaussNewton(downsampledEdgeCloud, downsampledSurfCloud);
+        else
+            solveCeres(downsampledEdgeCloud, downsampledSurfCloud);
     }else{
         printf("not enough points in map to associate, map error");
     }
@@ -119,7 +179,178 @@ void OdomEstimationClass::updatePointsToMap(const pcl::PointCloud<pcl::PointXYZI
     addPointsToMap(downsampledEdgeCloud,downsampledSurfCloud);
 }
 
-void OdomEstimationClass::pointAssociateToMap(pcl::PointXYZI const *const pi, pcl::PointXYZI *const po)
+void OdomEstimationClass::solveCeres(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in){
+    for (int iterCount = 0; iterCount < optimization_count; iterCount++){
+        ceres::LossFunction *loss_function = new ceres::HuberLoss(0.1);
+        ceres::Problem::Options problem_options;
+        ceres::Problem problem(problem_options);
+
+        problem.AddParameterBlock(parameters, 7, new PoseSE3Parameterization());
+
+        findCorrespondences(edge_in, surf_in, -1.0);
+        addEdgeCostFactor(problem,loss_function);
+        addSurfCostFactor(problem,loss_function);
+
+        ceres::Solver::Options options;
+        options.linear_solver_type = ceres::DENSE_QR;
+        options.max_num_iterations = 4;
+        options.minimizer_progress_to_stdout = false;
+        options.check_gradients = false;
+        options.gradient_check_relative_precision = 1e-4;
+        ceres::Solver::Summary summary;
+
+        ceres::Solve(options, &problem, &summary);
+
+    }
+}
+
+void OdomEstimationClass::solveCeresReuse(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in){
+    //the problem does not own the cost functions and the loss, they are reused by every iteration and every frame
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.enable_fast_removal = true;
+    ceres::Problem problem(problem_options);
+    problem.AddParameterBlock(parameters, 7, new PoseSE3Parameterization());
+
+    //the pool only grows, one cost function per downsampled point of the largest frame so far
+    Eigen::Vector3d zero = Eigen::Vector3d::Zero();
+    while(edgeCostFunctions.size() < edge_in->points.size())
+        edgeCostFunctions.emplace_back(new EdgeAnalyticCostFunction(zero, zero, zero));
+    while(surfCostFunctions.size() < surf_in->points.size())
+        surfCostFunctions.emplace_back(new SurfNormAnalyticCostFunction(zero, zero, 0.0));
+    edgeResidualIds.assign(edge_in->points.size(), NULL);
+    surfResidualIds.assign(surf_in->points.size(), NULL);
+
+    for (int iterCount = 0; iterCount < optimization_count; iterCount++){
+        //every point is searched in the first iteration, then only the points the last solve moved enough
+        findCorrespondences(edge_in, surf_in, iterCount == 0 ? -1.0 : reassociation_threshold);
+        updateEdgeResiduals(problem);
+        updateSurfResiduals(problem);
+
+        ceres::Solver::Options options;
+        options.linear_solver_type = ceres::DENSE_QR;
+        options.max_num_iterations = 4;
+        options.minimizer_progress_to_stdout = false;
+        options.check_gradients = false;
+        options.gradient_check_relative_precision = 1e-4;
+        ceres::Solver::Summary summary;
+
+        ceres::Solve(options, &problem, &summary);
+    }
+}
+
+//one residual with the iteratively reweighted weight of ceres::HuberLoss(delta), cost is 0.5 * rho(r^2) as in ceres
+//jacobian NULL: only the cost is added
+static void addHuberResidual(double residual, const Eigen::Matrix<double, 1, 6>* jacobian, double delta, NormalEquation& eq){
+    double abs_residual = std::abs(residual);
+    double weight = 1.0;
+    if(abs_residual > delta){
+        weight = delta / abs_residual;
+        eq.cost += delta * (abs_residual - 0.5 * delta);
+    }else{
+        eq.cost += 0.5 * residual * residual;
+    }
+    if(jacobian != NULL){
+        eq.H.noalias() += weight * jacobian->transpose() * *jacobian;
+        eq.g.noalias() += (weight * residual) * jacobian->transpose();
+    }
+    eq.residual_num++;
+}
+
+void OdomEstimationClass::buildNormalEquation(NormalEquation& total, bool cost_only){
+    const int block_size = 64;
+    const double huber_delta = 0.1;
+    int edge_num = (int)edgeCorrespondences.size();
+    int surf_num = (int)surfCorrespondences.size();
+    int edge_blocks = (edge_num + block_size - 1) / block_size;
+    int surf_blocks = (surf_num + block_size - 1) / block_size;
+    normalEquations.resize(edge_blocks + surf_blocks);
+    Eigen::Quaterniond q = q_w_curr;
+    Eigen::Vector3d t = t_w_curr;
+
+    //every block sums into its own entry, no lock
+    threadPool->parallelFor(edge_blocks + surf_blocks, [&](int block) {
+        NormalEquation& eq = normalEquations[block];
+        eq.H.setZero();
+        eq.g.setZero();
+        eq.cost = 0;
+        eq.residual_num = 0;
+        Eigen::Matrix<double, 1, 6> jacobian;
+        Eigen::Matrix<double, 1, 6>* jacobian_out = cost_only ? NULL : &jacobian;
+        if(block < edge_blocks){
+            int end = std::min(edge_num, (block + 1) * block_size);
+            for (int i = block * block_size; i < end; i++){
+                const EdgeCorrespondence& corr = edgeCorrespondences[i];
+                if (!corr.valid)
+                    continue;
+                double residual = edgeResidual(q, t, corr.curr_point, corr.point_a, corr.point_b, jacobian_out);
+                addHuberResidual(residual, jacobian_out, huber_delta, eq);
+            }
+        }else{
+            block -= edge_blocks;
+            int end = std::min(surf_num, (block + 1) * block_size);
+            for (int i = block * block_size; i < end; i++){
+                const SurfCorrespondence& corr = surfCorrespondences[i];
+                if (!corr.valid)
+                    continue;
+                double residual = surfResidual(q, t, corr.curr_point, corr.norm, corr.negative_OA_dot_norm, jacobian_out);
+                addHuberResidual(residual, jacobian_out, huber_delta, eq);
+            }
+        }
+    });
+
+    //reduction in block order, the sum does not depend on the thread count
+    total.H.setZero();
+    total.g.setZero();
+    total.cost = 0;
+    total.residual_num = 0;
+    for (int i = 0; i < (int)normalEquations.size(); i++){
+        total.H += normalEquations[i].H;
+        total.g += normalEquations[i].g;
+        total.cost += normalEquations[i].cost;
+        total.residual_num += normalEquations[i].residual_num;
+    }
+}
+
+void OdomEstimationClass::solveGaussNewton(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in){
+    PoseSE3Parameterization se3_update;
+    for (int iterCount = 0; iterCount < optimization_count; iterCount++){
+        findCorrespondences(edge_in, surf_in, iterCount == 0 ? -1.0 : reassociation_threshold);
+
+        //same budget as the ceres paths: at most 4 steps per association,
+        //then a cost-only pass so that the last step is checked like the others
+        double last_cost = std::numeric_limits<double>::max();
+        double last_parameters[7];
+        bool converged = false;
+        for (int step = 0; step <= 4; step++){
+            bool check_only = step == 4 || converged;
+            NormalEquation total;
+            buildNormalEquation(total, check_only);
+            if(total.residual_num < 6)
+                break;
+            //no line search: a step that increased the cost is undone and the iteration ends
+            if(total.cost > last_cost){
+                std::copy(last_parameters, last_parameters + 7, parameters);
+                break;
+            }
+            if(check_only)
+                break;
+            last_cost = total.cost;
+            std::copy(parameters, parameters + 7, last_parameters);
+
+            Eigen::Matrix<double, 6, 1> delta = total.H.ldlt().solve(-total.g);
+            if(!delta.allFinite())
+                break;
+            double parameters_plus_delta[7];
+            se3_update.Plus(parameters, delta.data(), parameters_plus_delta);
+            std::copy(parameters_plus_delta, parameters_plus_delta + 7, parameters);
+            converged = delta.norm() < 1e-6;
+        }
+    }
+}
+
+void OdomEstimationClass::pointAssociateToMap(pcl::PointXYZI const *const pi, pcl::PointXYZI *const po) const
 {
     Eigen::Vector3d point_curr(pi->x, pi->y, pi->z);
     Eigen::Vector3d point_w = q_w_curr * point_curr + t_w_curr;
@@ -137,162 +368,304 @@ void OdomEstimationClass::downSamplingToMap(const pcl::PointCloud<pcl::PointXYZI
     downSizeFilterSurf.filter(*surf_pc_out);    
 }
 
-void OdomEstimationClass::addEdgeCostFactor(const pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& map_in, ceres::Problem& problem, ceres::LossFunction *loss_function) {
-    int corner_num ;
-    int error_num = 0;//錯誤的線特徵有幾個
-    for (int i = 0; i < (int)pc_in->points.size(); i++) {
-        pcl::PointXYZI point_temp;
-        pointAssociateToMap(&(pc_in->points[i]), &point_temp);
-
-        std::vector<int> pointSearchInd;
-        std::vector<float> pointSearchSqDis;
-
-        kdtreeEdgeMap->nearestKSearch(point_temp, 5, pointSearchInd, pointSearchSqDis);
-        if (pointSearchSqDis[4] < 1.0) {
-            std::vector<Eigen::Vector3d> nearCorners;
-            Eigen::Vector3d center(0, 0, 0);
-            for (int j = 0; j < 5; j++) {
-                Eigen::Vector3d tmp(map_in->points[pointSearchInd[j]].x,
-                                    map_in->points[pointSearchInd[j]].y,
-                                    map_in->points[pointSearchInd[j]].z);
-                center = center + tmp;
-                nearCorners.push_back(tmp);
-        }
-            center = center / 5.0;
+void OdomEstimationClass::searchEdgeMap(const pcl::PointXYZI& point, std::vector<pcl::PointXYZI>& near_points, std::vector<float>& sq_dis) const{
+    if(map_backend == MAP_BACKEND_IKD_TREE){
+        ikdtreeEdgeMap.nearestKSearch(point, 5, near_points, sq_dis);
+        return;
+    }
+    if(map_backend == MAP_BACKEND_VOXEL_HASH){
+        voxelMapEdge.nearestKSearch(point, 5, near_points, sq_dis);
+        return;
+    }
+    std::vector<int> pointSearchInd;
+    kdtreeEdgeMap->nearestKSearch(point, 5, pointSearchInd, sq_dis);
+    near_points.clear();
+    for (size_t j = 0; j < pointSearchInd.size(); j++)
+        near_points.push_back(laserCloudCornerMap->points[pointSearchInd[j]]);
+}
 
-            Eigen::Matrix3d covMat = Eigen::Matrix3d::Zero();
-            for (int j = 0; j < 5; j++) {
-                Eigen::Matrix<double, 3, 1> tmpZeroMean = nearCorners[j] - center;
-                covMat = covMat + tmpZeroMean * tmpZeroMean.transpose();
-            }
+void OdomEstimationClass::searchSurfMap(const pcl::PointXYZI& point, std::vector<pcl::PointXYZI>& near_points, std::vector<float>& sq_dis) const{
+    if(map_backend == MAP_BACKEND_IKD_TREE){
+        ikdtreeSurfMap.nearestKSearch(point, 5, near_points, sq_dis);
+        return;
+    }
+    if(map_backend == MAP_BACKEND_VOXEL_HASH){
+        voxelMapSurf.nearestKSearch(point, 5, near_points, sq_dis);
+        return;
+    }
+    std::vector<int> pointSearchInd;
+    kdtreeSurfMap->nearestKSearch(point, 5, pointSearchInd, sq_dis);
+    near_points.clear();
+    for (size_t j = 0; j < pointSearchInd.size(); j++)
+        near_points.push_back(laserCloudSurfMap->points[pointSearchInd[j]]);
+}
 
-            Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> saes(covMat);
-
-            Eigen::Vector3d unit_direction = saes.eigenvectors().col(2);
-            Eigen::Vector3d curr_point(pc_in->points[i].x, pc_in->points[i].y, pc_in->points[i].z);
-            Eigen::Vector3d point_a, point_b;
-
-            if (saes.eigenvalues()[2] > 3 * saes.eigenvalues()[1]) {
-                Eigen::Vector3d point_on_line = center;
-                point_a = 0.1 * unit_direction + point_on_line;
-                point_b = -0.1 * unit_direction + point_on_line;
-
-                ceres::CostFunction *cost_function = new EdgeAnalyticCostFunction(curr_point, point_a, point_b);
-                problem.AddResidualBlock(cost_function, loss_function, parameters);
-                corner_num++;
-
-                // 使用 Eigen::JacobiSVD 來計算最小平方的直線方程
-                Eigen::MatrixXd A(nearCorners.size(), 2);
-                Eigen::VectorXd b(nearCorners.size());
-                for (double j = 0; j < nearCorners.size(); ++j) {
-                    A(j, 0) = nearCorners[j].x();
-                    A(j, 1) = 1;
-                    b(j) = nearCorners[j].y();
-                }
-                Eigen::VectorXd x = A.jacobiSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(b);
-
-                // 計算 curr_point 到直線的距離
-                double distance_fitted_line = std::abs(x(0) * curr_point.x() - curr_point.y() + x(1)) / std::sqrt(x(0) * x(0) + 1);
-
-                // Calculate the distance from curr_point to the estimated line
-                Eigen::Vector3d line_vector = point_b - point_a;
-                double distance_estimated_line = (line_vector.cross(curr_point - point_a)).norm() / line_vector.norm();
-
-                // Output the difference between the distances
-                double distance_difference = distance_fitted_line - distance_estimated_line;
-                // 檢查距離差異是否超過1並增加 error_num
-                if (std::abs(distance_difference) > 1) {
-                    error_num++;
-                }
-            }
+void OdomEstimationClass::findCorrespondences(const pcl::PointCloud<pcl::PointXYZI>::Ptr& edge_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& surf_in, double reassociation_threshold_in){
+    const int block_size = 64;
+    int edge_num = (int)edge_in->points.size();
+    int surf_num = (int)surf_in->points.size();
+    edgeCorrespondences.resize(edge_num);
+    surfCorrespondences.resize(surf_num);
+
+    //edge blocks first, then surf blocks, so both kinds run at the same time on the pool
+    //every task writes only its own slots, the maps and the pose are read-only here
+    int edge_blocks = (edge_num + block_size - 1) / block_size;
+    int surf_blocks = (surf_num + block_size - 1) / block_size;
+    threadPool->parallelFor(edge_blocks + surf_blocks, [&](int block) {
+        if(block < edge_blocks){
+            int end = std::min(edge_num, (block + 1) * block_size);
+            for (int i = block * block_size; i < end; i++)
+                findEdgeCorrespondence(edge_in->points[i], reassociation_threshold_in, edgeCorrespondences[i]);
+        }else{
+            block -= edge_blocks;
+            int end = std::min(surf_num, (block + 1) * block_size);
+            for (int i = block * block_size; i < end; i++)
+                findSurfCorrespondence(surf_in->points[i], reassociation_threshold_in, surfCorrespondences[i]);
         }
+    });
+}
+
+void OdomEstimationClass::findEdgeCorrespondence(const pcl::PointXYZI& point_in, double reassociation_threshold_in, EdgeCorrespondence& result) const {
+    pcl::PointXYZI point_temp;
+    pointAssociateToMap(&point_in, &point_temp);
+    Eigen::Vector3d point_w(point_temp.x, point_temp.y, point_temp.z);
+    //keep the last search while the point stays close to where it was searched
+    if (reassociation_threshold_in >= 0 && (point_w - result.associated_point).norm() <= reassociation_threshold_in) {
+        result.updated = false;
+        return;
     }
-    // std::cout << "corner = " << corner_num << std::endl;
-    std::cout << "線特徵錯誤數量 = " << error_num << std::endl;
+    result.updated = true;
+    result.associated_point = point_w;
+    result.valid = false;
+    result.fit_error = false;
+
+    std::vector<pcl::PointXYZI> nearPoints;
+    std::vector<float> pointSearchSqDis;
+    searchEdgeMap(point_temp, nearPoints, pointSearchSqDis);
+    if (pointSearchSqDis.size() != 5 || pointSearchSqDis[4] >= 1.0)
+        return;
+
+    std::vector<Eigen::Vector3d> nearCorners;
+    Eigen::Vector3d center(0, 0, 0);
+    for (int j = 0; j < 5; j++) {
+        Eigen::Vector3d tmp(nearPoints[j].x,
+                            nearPoints[j].y,
+                            nearPoints[j].z);
+        center = center + tmp;
+        nearCorners.push_back(tmp);
+    }
+    center = center / 5.0;
+
+    Eigen::Matrix3d covMat = Eigen::Matrix3d::Zero();
+    for (int j = 0; j < 5; j++) {
+        Eigen::Matrix<double, 3, 1> tmpZeroMean = nearCorners[j] - center;
+        covMat = covMat + tmpZeroMean * tmpZeroMean.transpose();
+    }
+
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> saes(covMat);
+    if (saes.eigenvalues()[2] <= 3 * saes.eigenvalues()[1])
+        return;
+
+    Eigen::Vector3d unit_direction = saes.eigenvectors().col(2);
+    Eigen::Vector3d point_on_line = center;
+    result.curr_point = Eigen::Vector3d(point_in.x, point_in.y, point_in.z);
+    result.point_a = 0.1 * unit_direction + point_on_line;
+    result.point_b = -0.1 * unit_direction + point_on_line;
+    result.valid = true;
+
+    // 使用 Eigen::JacobiSVD 來計算最小平方的直線方程
+    Eigen::MatrixXd A(nearCorners.size(), 2);
+    Eigen::VectorXd b(nearCorners.size());
+    for (int j = 0; j < (int)nearCorners.size(); ++j) {
+        A(j, 0) = nearCorners[j].x();
+        A(j, 1) = 1;
+        b(j) = nearCorners[j].y();
+    }
+    Eigen::VectorXd x = A.jacobiSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(b);
+
+    // 計算 curr_point 到直線的距離
+    const Eigen::Vector3d& curr_point = result.curr_point;
+    double distance_fitted_line = std::abs(x(0) * curr_point.x() - curr_point.y() + x(1)) / std::sqrt(x(0) * x(0) + 1);
+
+    // Calculate the distance from curr_point to the estimated line
+    Eigen::Vector3d line_vector = result.point_b - result.point_a;
+    double distance_estimated_line = (line_vector.cross(curr_point - result.point_a)).norm() / line_vector.norm();
+
+    // 檢查距離差異是否超過1
+    double distance_difference = distance_fitted_line - distance_estimated_line;
+    result.fit_error = std::abs(distance_difference) > 1;
 }
 
+void OdomEstimationClass::findSurfCorrespondence(const pcl::PointXYZI& point_in, double reassociation_threshold_in, SurfCorrespondence& result) const {
+    pcl::PointXYZI point_temp;
+    pointAssociateToMap(&point_in, &point_temp);
+    Eigen::Vector3d point_w(point_temp.x, point_temp.y, point_temp.z);
+    //keep the last search while the point stays close to where it was searched
+    if (reassociation_threshold_in >= 0 && (point_w - result.associated_point).norm() <= reassociation_threshold_in) {
+        result.updated = false;
+        return;
+    }
+    result.updated = true;
+    result.associated_point = point_w;
+    result.valid = false;
+    result.fit_error = false;
+
+    std::vector<pcl::PointXYZI> nearPoints;
+    std::vector<float> pointSearchSqDis;
+    searchSurfMap(point_temp, nearPoints, pointSearchSqDis);
+    if (pointSearchSqDis.size() != 5 || pointSearchSqDis[4] >= 1.0)
+        return;
+
+    Eigen::Matrix<double, 5, 3> matA0;
+    Eigen::Matrix<double, 5, 1> matB0 = -1 * Eigen::Matrix<double, 5, 1>::Ones(); //5*1 都是-1
+    for (int j = 0; j < 5; j++)
+    {
+        matA0(j, 0) = nearPoints[j].x;
+        matA0(j, 1) = nearPoints[j].y;
+        matA0(j, 2) = nearPoints[j].z;
+    }
+    // find the norm of plane
+    Eigen::Vector3d norm = matA0.colPivHouseholderQr().solve(matB0);
+    double negative_OA_dot_norm = 1 / norm.norm();
+    norm.normalize();
+
+    for (int j = 0; j < 5; j++)
+    {
+        // if OX * n > 0.2, then plane is not fit well
+        if (fabs(norm(0) * nearPoints[j].x +
+                 norm(1) * nearPoints[j].y +
+                 norm(2) * nearPoints[j].z + negative_OA_dot_norm) > 0.2)
+            return;
+    }
+    result.curr_point = Eigen::Vector3d(point_in.x, point_in.y, point_in.z);
+    result.norm = norm;
+    result.negative_OA_dot_norm = negative_OA_dot_norm;
+    result.valid = true;
+
+    //verify by PCA
+    // 1. 計算點的均值
+    Eigen::Vector3d mean = matA0.colwise().mean();
+
+    // 2. 中心化數據
+    Eigen::MatrixXd centered = matA0.rowwise() - mean.transpose();
+
+    // 3. 計算協方差矩陣
+    Eigen::MatrixXd cov = centered.adjoint() * centered / double(matA0.rows() - 1);
+
+    // 4. 進行特徵分解
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigenSolver(cov);
+    Eigen::MatrixXd eigenVectors = eigenSolver.eigenvectors();
+
+    // 5. 提取法向量 (最小特徵值對應的特徵向量)
+    Eigen::Vector3d normal = eigenVectors.col(0);
+    normal.normalize();
+    //比對誤差
+    Eigen::Vector3d diff = norm - normal;
+    result.fit_error = diff.x() >= 1 || diff.y() >= 1 || diff.z() >= 1;
+}
 
+void OdomEstimationClass::addEdgeCostFactor(ceres::Problem& problem, ceres::LossFunction *loss_function) {
+    int error_num = 0;//錯誤的線特徵有幾個
+    for (int i = 0; i < (int)edgeCorrespondences.size(); i++) {
+        const EdgeCorrespondence& corr = edgeCorrespondences[i];
+        if (!corr.valid)
+            continue;
+        ceres::CostFunction *cost_function = new EdgeAnalyticCostFunction(corr.curr_point, corr.point_a, corr.point_b);
+        problem.AddResidualBlock(cost_function, loss_function, parameters);
+        if (corr.fit_error)
+            error_num++;
+    }
+    std::cout << "線特徵錯誤數量 = " << error_num << std::endl;
+}
 
-void OdomEstimationClass::addSurfCostFactor(const pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, const pcl::PointCloud<pcl::PointXYZI>::Ptr& map_in, ceres::Problem& problem, ceres::LossFunction *loss_function){
-    int surf_num=0;
+void OdomEstimationClass::addSurfCostFactor(ceres::Problem& problem, ceres::LossFunction *loss_function){
     int error_num = 0;
-    //std::cout << "surf size = " << (int)pc_in->points.size() << std::endl;
-    for (int i = 0; i < (int)pc_in->points.size(); i++)
-    {
-        pcl::PointXYZI point_temp;
-        pointAssociateToMap(&(pc_in->points[i]), &point_temp);
-        std::vector<int> pointSearchInd;
-        std::vector<float> pointSearchSqDis;
-        kdtreeSurfMap->nearestKSearch(point_temp, 5, pointSearchInd, pointSearchSqDis);
-
-        Eigen::Matrix<double, 5, 3> matA0;
-        Eigen::Matrix<double, 5, 1> matB0 = -1 * Eigen::Matrix<double, 5, 1>::Ones(); //5*1 都是-1
-        if (pointSearchSqDis[4] < 1.0)
-        {
-            
-            for (int j = 0; j < 5; j++)
-            {
-                matA0(j, 0) = map_in->points[pointSearchInd[j]].x;
-                matA0(j, 1) = map_in->points[pointSearchInd[j]].y;
-                matA0(j, 2) = map_in->points[pointSearchInd[j]].z;
-            }
-            // find the norm of plane
-            Eigen::Vector3d norm = matA0.colPivHouseholderQr().solve(matB0);
-            double negative_OA_dot_norm = 1 / norm.norm();
-            norm.normalize();
-
-            bool planeValid = true;
-            for (int j = 0; j < 5; j++)
-            {
-                // if OX * n > 0.2, then plane is not fit well
-                if (fabs(norm(0) * map_in->points[pointSearchInd[j]].x +
-                         norm(1) * map_in->points[pointSearchInd[j]].y +
-                         norm(2) * map_in->points[pointSearchInd[j]].z + negative_OA_dot_norm) > 0.2)
-                {
-                    planeValid = false;
-                    break;
-                }
-            }
-            Eigen::Vector3d curr_point(pc_in->points[i].x, pc_in->points[i].y, pc_in->points[i].z);
-            if (planeValid)
-            {
-                ceres::CostFunction *cost_function = new SurfNormAnalyticCostFunction(curr_point, norm, negative_OA_dot_norm);    
-                problem.AddResidualBlock(cost_function, loss_function, parameters);
-                            //verify by PCA
-                // 1. 計算點的均值
-                Eigen::Vector3d mean = matA0.colwise().mean();
-
-                // 2. 中心化數據
-                Eigen::MatrixXd centered = matA0.rowwise() - mean.transpose();
-
-                // 3. 計算協方差矩陣
-                Eigen::MatrixXd cov = centered.adjoint() * centered / double(matA0.rows() - 1);
-
-                // 4. 進行特徵分解
-                Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigenSolver(cov);
-                //Eigen::Vector3d eigenValues = eigenSolver.eigenvalues();
-                Eigen::MatrixXd eigenVectors = eigenSolver.eigenvectors();
-
-                // 5. 提取法向量 (最小特徵值對應的特徵向量)
-                Eigen::Vector3d normal = eigenVectors.col(0);
-                    surf_num++;
-                                    // 正規化
-                normal.normalize();  
-                //比對誤差
-                Eigen::Vector3d diff = norm - normal;
-                if(diff.x() >= 1||diff.y() >= 1||diff.z() >= 1){
-                    error_num = error_num + 1 ;
-                }
+    for (int i = 0; i < (int)surfCorrespondences.size(); i++) {
+        const SurfCorrespondence& corr = surfCorrespondences[i];
+        if (!corr.valid)
+            continue;
+        ceres::CostFunction *cost_function = new SurfNormAnalyticCostFunction(corr.curr_point, corr.norm, corr.negative_OA_dot_norm);
+        problem.AddResidualBlock(cost_function, loss_function, parameters);
+        if (corr.fit_error)
+            error_num++;
+    }
+    std::cout << "平面錯誤特徵數量 = " << error_num << std::endl;
+}
+
+void OdomEstimationClass::updateEdgeResiduals(ceres::Problem& problem){
+    for (int i = 0; i < (int)edgeCorrespondences.size(); i++) {
+        const EdgeCorrespondence& corr = edgeCorrespondences[i];
+        if (corr.updated) {
+            if (corr.valid) {
+                //the problem only keeps the pointer, the new line is read at the next evaluation
+                EdgeAnalyticCostFunction* cost_function = edgeCostFunctions[i].get();
+                cost_function->curr_point = corr.curr_point;
+                cost_function->last_point_a = corr.point_a;
+                cost_function->last_point_b = corr.point_b;
+                if (edgeResidualIds[i] == NULL)
+                    edgeResidualIds[i] = problem.AddResidualBlock(cost_function, huberLoss.get(), parameters);
+            } else if (edgeResidualIds[i] != NULL) {
+                problem.RemoveResidualBlock(edgeResidualIds[i]);
+                edgeResidualIds[i] = NULL;
             }
         }
+    }
+}
 
+void OdomEstimationClass::updateSurfResiduals(ceres::Problem& problem){
+    for (int i = 0; i < (int)surfCorrespondences.size(); i++) {
+        const SurfCorrespondence& corr = surfCorrespondences[i];
+        if (corr.updated) {
+            if (corr.valid) {
+                SurfNormAnalyticCostFunction* cost_function = surfCostFunctions[i].get();
+                cost_function->curr_point = corr.curr_point;
+                cost_function->plane_unit_norm = corr.norm;
+                cost_function->negative_OA_dot_norm = corr.negative_OA_dot_norm;
+                if (surfResidualIds[i] == NULL)
+                    surfResidualIds[i] = problem.AddResidualBlock(cost_function, huberLoss.get(), parameters);
+            } else if (surfResidualIds[i] != NULL) {
+                problem.RemoveResidualBlock(surfResidualIds[i]);
+                surfResidualIds[i] = NULL;
+            }
+        }
     }
-    // std::cout << "surf = " << surf_num << std::endl;
-    std::cout << "平面錯誤特徵數量 = " << error_num << std::endl;
 }
 
 void OdomEstimationClass::addPointsToMap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& downsampledEdgeCloud, const pcl::PointCloud<pcl::PointXYZI>::Ptr& downsampledSurfCloud){
 
+    double x_min = +odom.translation().x()-100;
+    double y_min = +odom.translation().y()-100;
+    double z_min = +odom.translation().z()-100;
+    double x_max = +odom.translation().x()+100;
+    double y_max = +odom.translation().y()+100;
+    double z_max = +odom.translation().z()+100;
+
+    if(map_backend == MAP_BACKEND_IKD_TREE || map_backend == MAP_BACKEND_VOXEL_HASH){
+        //only the new points are inserted, the points out of the local map are deleted (trees) or evicted (voxels)
+        pcl::PointCloud<pcl::PointXYZI> edge_world;
+        pcl::PointCloud<pcl::PointXYZI> surf_world;
+        edge_world.points.resize(downsampledEdgeCloud->points.size());
+        surf_world.points.resize(downsampledSurfCloud->points.size());
+        for (int i = 0; i < (int)downsampledEdgeCloud->points.size(); i++)
+            pointAssociateToMap(&downsampledEdgeCloud->points[i], &edge_world.points[i]);
+        for (int i = 0; i < (int)downsampledSurfCloud->points.size(); i++)
+            pointAssociateToMap(&downsampledSurfCloud->points[i], &surf_world.points[i]);
+        Eigen::Vector3f box_min(x_min, y_min, z_min);
+        Eigen::Vector3f box_max(x_max, y_max, z_max);
+        if(map_backend == MAP_BACKEND_IKD_TREE){
+            ikdtreeEdgeMap.addPoints(edge_world);
+            ikdtreeSurfMap.addPoints(surf_world);
+            ikdtreeEdgeMap.cropToBox(box_min, box_max);
+            ikdtreeSurfMap.cropToBox(box_min, box_max);
+        }else{
+            voxelMapEdge.addPoints(edge_world);
+            voxelMapSurf.addPoints(surf_world);
+            voxelMapEdge.cropToBox(box_min, box_max);
+            voxelMapSurf.cropToBox(box_min, box_max);
+        }
+        return;
+    }
+
     for (int i = 0; i < (int)downsampledEdgeCloud->points.size(); i++)
     {
         pcl::PointXYZI point_temp;
@@ -307,13 +680,6 @@ void OdomEstimationClass::addPointsToMap(const pcl::PointCloud<pcl::PointXYZI>::
         laserCloudSurfMap->push_back(point_temp);
     }
     
-    double x_min = +odom.translation().x()-100;
-    double y_min = +odom.translation().y()-100;
-    double z_min = +odom.translation().z()-100;
-    double x_max = +odom.translation().x()+100;
-    double y_max = +odom.translation().y()+100;
-    double z_max = +odom.translation().z()+100;
-    
     //ROS_INFO("size : %f,%f,%f,%f,%f,%f", x_min, y_min, z_min,x_max, y_max, z_max);
     cropBoxFilter.setMin(Eigen::Vector4f(x_min, y_min, z_min, 1.0));
     cropBoxFilter.setMax(Eigen::Vector4f(x_max, y_max, z_max, 1.0));
@@ -334,7 +700,16 @@ void OdomEstimationClass::addPointsToMap(const pcl::PointCloud<pcl::PointXYZI>::
 }
 
 void OdomEstimationClass::getMap(pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudMap){
-    
+    if(map_backend == MAP_BACKEND_IKD_TREE){
+        ikdtreeSurfMap.getPoints(*laserCloudMap);
+        ikdtreeEdgeMap.getPoints(*laserCloudMap);
+        return;
+    }
+    if(map_backend == MAP_BACKEND_VOXEL_HASH){
+        voxelMapSurf.getPoints(*laserCloudMap);
+        voxelMapEdge.getPoints(*laserCloudMap);
+        return;
+    }
     *laserCloudMap += *laserCloudSurfMap;
     *laserCloudMap += *laserCloudCornerMap;
 }
@@ -5,9 +5,9 @@
 //c++ lib
 #include <cmath>
 #include <vector>
-#include <mutex>
-#include <queue>
+#include <algorithm>
 #include <thread>
+#include <atomic>
 #include <chrono>
 
 //ros lib
@@ -25,168 +25,213 @@
 //local lib
 #include "lidar.h"
 #include "odomEstimationClass.h"
+#include "floamNodes.h"
+#include "blockingQueue.h"
+#include "stageStats.h"
+#include "queueDiagnostics.h"
+
+namespace odom_estimation_node{
 
 int sequence_number;
 
 std::ofstream outputFile;
+std::ofstream timeFile; //odom estimation time (ms) of each line in outputFile, 0 for the first frame
 int is_outputfile;
 
 OdomEstimationClass odomEstimation;
-std::mutex mutex_lock;
-std::queue<sensor_msgs::PointCloud2ConstPtr> pointCloudEdgeBuf;
-std::queue<sensor_msgs::PointCloud2ConstPtr> pointCloudSurfBuf;
-std::queue<sensor_msgs::ImageConstPtr> imageBuf;
+BlockingQueue<sensor_msgs::PointCloud2ConstPtr> pointCloudEdgeBuf;
+BlockingQueue<sensor_msgs::PointCloud2ConstPtr> pointCloudSurfBuf;
+BlockingQueue<sensor_msgs::ImageConstPtr> imageBuf;
+StageStats stageStats;
+QueueDiagnostics queueDiagnostics;
+ros::Timer diagnosticsTimer;
+std::thread odom_estimation_process;
+std::atomic<bool> is_setup(false);
+
+//queue sizes and drop counters on /diagnostics once per second
+void publishDiagnostics(const ros::TimerEvent&)
+{
+    queueDiagnostics.addQueue("edge", pointCloudEdgeBuf);
+    queueDiagnostics.addQueue("surf", pointCloudSurfBuf);
+    queueDiagnostics.addQueue("image", imageBuf);
+    queueDiagnostics.publish();
+}
 lidar::Lidar lidar_param;
 
 ros::Publisher pubLaserOdometry;
+ros::Subscriber subEdgeLaserCloud;
+ros::Subscriber subSurfLaserCloud;
+ros::Subscriber subprocessimage;
 void velodyneSurfHandler(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg)
 {
-    mutex_lock.lock();
     pointCloudSurfBuf.push(laserCloudMsg);
-    mutex_lock.unlock();
 }
 void velodyneEdgeHandler(const sensor_msgs::PointCloud2ConstPtr &laserCloudMsg)
 {
-    mutex_lock.lock();
     pointCloudEdgeBuf.push(laserCloudMsg);
-    mutex_lock.unlock();
 }
 void imageHandler(const sensor_msgs::ImageConstPtr &ImageMsg)
 {
-    mutex_lock.lock();
     imageBuf.push(ImageMsg);
-    mutex_lock.unlock();
 }
 
 bool is_odom_inited = false;
 double total_time =0;
 int total_frame=0;
-void odom_estimation(){
-    while(1){
-        if(!pointCloudEdgeBuf.empty() && !pointCloudSurfBuf.empty() && !imageBuf.empty()){
-
-            //read data
-            mutex_lock.lock();
-            if(!pointCloudSurfBuf.empty() && (pointCloudSurfBuf.front()->header.stamp.toSec()<pointCloudEdgeBuf.front()->header.stamp.toSec()-0.5*lidar_param.scan_period)
-                && (imageBuf.front()->header.stamp.toSec()<pointCloudEdgeBuf.front()->header.stamp.toSec()-0.5*lidar_param.scan_period)){
-                
-                pointCloudSurfBuf.pop();
-                imageBuf.pop();
-                ROS_WARN_ONCE("time stamp unaligned with extra point cloud, pls check your data --> odom correction");
-                mutex_lock.unlock();
-                continue;  
-            }
 
-            if(!pointCloudEdgeBuf.empty() && (pointCloudEdgeBuf.front()->header.stamp.toSec()<pointCloudSurfBuf.front()->header.stamp.toSec()-0.5*lidar_param.scan_period)
-                && (imageBuf.front()->header.stamp.toSec()<pointCloudEdgeBuf.front()->header.stamp.toSec()-0.5*lidar_param.scan_period)){
-                
-                pointCloudEdgeBuf.pop();
-                imageBuf.pop();
-                ROS_WARN_ONCE("time stamp unaligned with extra point cloud, pls check your data --> odom correction");
-                mutex_lock.unlock();
-                continue;  
-            }
-            //if time aligned 
-            
-            pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_surf_in(new pcl::PointCloud<pcl::PointXYZI>());
-            pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud_edge_in(new pcl::PointCloud<pcl::PointXYZI>());
-            pcl::fromROSMsg(*pointCloudEdgeBuf.front(), *pointcloud_edge_in);
-            pcl::fromROSMsg(*pointCloudSurfBuf.front(), *pointcloud_surf_in);
-            ros::Time pointcloud_time = (pointCloudSurfBuf.front())->header.stamp;
-            pointCloudEdgeBuf.pop();
-            pointCloudSurfBuf.pop();
-
-            sensor_msgs::ImageConstPtr imageMsg = imageBuf.front();
-            
-            imageBuf.pop();
-
-            mutex_lock.unlock();
-
-            if(is_odom_inited == false){
-                odomEstimation.initMapWithPoints(pointcloud_edge_in, pointcloud_surf_in);
-                is_odom_inited = true;
-                ROS_INFO("odom inited");
-            }else{
-                std::chrono::time_point<std::chrono::system_clock> start, end;
-                start = std::chrono::system_clock::now();
-                odomEstimation.updatePointsToMap(pointcloud_edge_in, pointcloud_surf_in, imageMsg, sequence_number);
-                end = std::chrono::system_clock::now();
-                std::chrono::duration<float> elapsed_seconds = end - start;
-                total_frame++;
-                float time_temp = elapsed_seconds.count() * 1000;
-                total_time+=time_temp;
-                ROS_INFO("Average odom estimation time %f ms \n \n", total_time/total_frame);
-            }
+//odometry of one aligned edge/surf/image frame, the trajectory file is written here as well
+nav_msgs::OdometryPtr processFrame(const PointCloud2View& pointcloud_edge_in, const PointCloud2View& pointcloud_surf_in,
+                                   const sensor_msgs::ImageConstPtr& imageMsg, const ros::Time& pointcloud_time)
+{
+    float time_temp = 0;
+    if(is_odom_inited == false){
+        odomEstimation.initMapWithPoints(pointcloud_edge_in, pointcloud_surf_in);
+        is_odom_inited = true;
+        ROS_INFO("odom inited");
+    }else{
+        std::chrono::time_point<std::chrono::system_clock> start, end;
+        start = std::chrono::system_clock::now();
+        odomEstimation.updatePointsToMap(pointcloud_edge_in, pointcloud_surf_in, imageMsg, sequence_number);
+        end = std::chrono::system_clock::now();
+        std::chrono::duration<float> elapsed_seconds = end - start;
+        total_frame++;
+        time_temp = elapsed_seconds.count() * 1000;
+        total_time+=time_temp;
+        ROS_INFO("Average odom estimation time %f ms \n \n", total_time/total_frame);
+    }
 
+    Eigen::Quaterniond q_current(odomEstimation.odom.rotation());
+    //q_current.normalize();
+    Eigen::Vector3d t_current = odomEstimation.odom.translation();
+
+    // odometry message
+    nav_msgs::OdometryPtr laserOdometry(new nav_msgs::Odometry());
+    laserOdometry->header.frame_id = "map";
+    laserOdometry->child_frame_id = "base_link";
+    laserOdometry->header.stamp = pointcloud_time;
+    laserOdometry->pose.pose.orientation.x = q_current.x();
+    laserOdometry->pose.pose.orientation.y = q_current.y();
+    laserOdometry->pose.pose.orientation.z = q_current.z();
+    laserOdometry->pose.pose.orientation.w = q_current.w();
+    laserOdometry->pose.pose.position.x = t_current.x();
+    laserOdometry->pose.pose.position.y = t_current.y();
+    laserOdometry->pose.pose.position.z = t_current.z();
+
+    Eigen::Quaterniond q_new;
+    q_new.x() = -q_current.y();
+    q_new.y() = -q_current.z();
+    q_new.z() = q_current.x();
+    q_new.w() = q_current.w();
+
+    Eigen::Vector3d t_new;
+    t_new.x() = -t_current.y();
+    t_new.y() = -t_current.z();
+    t_new.z() =  t_current.x();
+
+    Eigen::Matrix4d transformation_matrix;
+    transformation_matrix.block<3, 3>(0, 0) = q_new.toRotationMatrix();
+    transformation_matrix.col(3).head<3>() = t_new;
+
+    // std::cout << "transformation_matrix\n" << transformation_matrix << std::endl;
+
+    if(is_outputfile == 1){
+        extern std::ofstream outputFile;
+        outputFile << std::scientific << std::setprecision(6);
+
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                outputFile << transformation_matrix(i, j) << " ";
+            }
+        }
+        outputFile << std::endl;
+        timeFile << std::fixed << std::setprecision(3) << time_temp << std::endl;
+    }
 
+    return laserOdometry;
+}
 
+void publish(const nav_msgs::OdometryPtr& laserOdometry)
+{
+    const geometry_msgs::Pose& pose = laserOdometry->pose.pose;
+    static tf::TransformBroadcaster br;
+    tf::Transform transform;
+    transform.setOrigin( tf::Vector3(pose.position.x, pose.position.y, pose.position.z) );
+    tf::Quaternion q(pose.orientation.x, pose.orientation.y, pose.orientation.z, pose.orientation.w);
+    transform.setRotation(q);
+    br.sendTransform(tf::StampedTransform(transform, ros::Time::now(), "map", "base_link"));
+
+    pubLaserOdometry.publish(laserOdometry);
+}
 
-            Eigen::Quaterniond q_current(odomEstimation.odom.rotation());
-            //q_current.normalize();
-            Eigen::Vector3d t_current = odomEstimation.odom.translation();
-
-            static tf::TransformBroadcaster br;
-            tf::Transform transform;
-            transform.setOrigin( tf::Vector3(t_current.x(), t_current.y(), t_current.z()) );
-            tf::Quaternion q(q_current.x(),q_current.y(),q_current.z(),q_current.w());
-            transform.setRotation(q);
-            br.sendTransform(tf::StampedTransform(transform, ros::Time::now(), "map", "base_link"));
-
-            // publish odometry
-            nav_msgs::Odometry laserOdometry;
-            laserOdometry.header.frame_id = "map";
-            laserOdometry.child_frame_id = "base_link";
-            laserOdometry.header.stamp = pointcloud_time;
-            laserOdometry.pose.pose.orientation.x = q_current.x();
-            laserOdometry.pose.pose.orientation.y = q_current.y();
-            laserOdometry.pose.pose.orientation.z = q_current.z();
-            laserOdometry.pose.pose.orientation.w = q_current.w();
-            laserOdometry.pose.pose.position.x = t_current.x();
-            laserOdometry.pose.pose.position.y = t_current.y();
-            laserOdometry.pose.pose.position.z = t_current.z();
-            pubLaserOdometry.publish(laserOdometry);
-
-            Eigen::Quaterniond q_new;
-            q_new.x() = -q_current.y();
-            q_new.y() = -q_current.z();
-            q_new.z() = q_current.x();
-            q_new.w() = q_current.w();
-
-            Eigen::Vector3d t_new;
-            t_new.x() = -t_current.y();
-            t_new.y() = -t_current.z();
-            t_new.z() =  t_current.x();
-
-            Eigen::Matrix4d transformation_matrix;
-            transformation_matrix.block<3, 3>(0, 0) = q_new.toRotationMatrix();
-            transformation_matrix.col(3).head<3>() = t_new;
-
-            // std::cout << "transformation_matrix\n" << transformation_matrix << std::endl;
-
-            if(is_outputfile == 1){
-                extern std::ofstream outputFile;
-                outputFile << std::scientific << std::setprecision(6);
-
-                for (int i = 0; i < 3; ++i) {
-                    for (int j = 0; j < 4; ++j) {
-                        outputFile << transformation_matrix(i, j) << " ";
-                    }
-                }
-                outputFile << std::endl;
-            }
+//sleeps on the three queues until edge, surf and image of one frame are there
+void odom_estimation(){
+    sensor_msgs::PointCloud2ConstPtr edge_msg;
+    sensor_msgs::PointCloud2ConstPtr surf_msg;
+    sensor_msgs::ImageConstPtr imageMsg;
+    std::chrono::steady_clock::time_point edge_time, surf_time, image_time;
+    while(1){
+        //read data, only the messages dropped by the last alignment check are taken again
+        if(!edge_msg && !pointCloudEdgeBuf.pop(edge_msg, edge_time))
+            break;
+        if(!surf_msg && !pointCloudSurfBuf.pop(surf_msg, surf_time))
+            break;
+        if(!imageMsg && !imageBuf.pop(imageMsg, image_time))
+            break;
+
+        //each queue drops on its own when full (queue_policy), so any of the three may be behind the others:
+        //drop every message older than the newest one and pop its queue again until the stamps agree
+        double edge_stamp = edge_msg->header.stamp.toSec();
+        double surf_stamp = surf_msg->header.stamp.toSec();
+        double image_stamp = imageMsg->header.stamp.toSec();
+        double newest_stamp = std::max(edge_stamp, std::max(surf_stamp, image_stamp));
+        double oldest_allowed = newest_stamp - 0.5*lidar_param.scan_period;
+        if(edge_stamp < oldest_allowed || surf_stamp < oldest_allowed || image_stamp < oldest_allowed){
+            if(edge_stamp < oldest_allowed)
+                edge_msg.reset();
+            if(surf_stamp < oldest_allowed)
+                surf_msg.reset();
+            if(image_stamp < oldest_allowed)
+                imageMsg.reset();
+            ROS_WARN_ONCE("time stamp unaligned with extra point cloud, pls check your data --> odom correction");
+            continue;
+        }
 
+        //if time aligned 
+        size_t queue_depth = pointCloudEdgeBuf.size();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point ready = std::max(edge_time, std::max(surf_time, image_time));
+
+        //直接讀message的資料, 不轉成pcl點雲
+        PointCloud2View pointcloud_edge_in(edge_msg);
+        PointCloud2View pointcloud_surf_in(surf_msg);
+        if(!pointcloud_edge_in.valid() || !pointcloud_surf_in.valid()){
+            //nothing to match, the pose would only be extrapolated and published as if it was estimated
+            ROS_WARN("point cloud without float x/y/z fields, frame skipped, pls check your data --> odom estimation node");
+            edge_msg.reset();
+            surf_msg.reset();
+            imageMsg.reset();
+            continue;
+        }
+        ros::Time pointcloud_time = surf_msg->header.stamp;
+
+        nav_msgs::OdometryPtr laserOdometry = processFrame(pointcloud_edge_in, pointcloud_surf_in, imageMsg, pointcloud_time);
+        publish(laserOdometry);
+        edge_msg.reset();
+        surf_msg.reset();
+        imageMsg.reset();
+
+        stageStats.addFrame(queue_depth, StageStats::elapsedMs(ready, start), StageStats::elapsedMs(start, std::chrono::steady_clock::now()));
+        if(stageStats.frames() >= 100){
+            ROS_INFO("odom estimation stage: %s", stageStats.summary().c_str());
+            ROS_INFO("odom estimation latency: %s", stageStats.histogram().c_str());
+            stageStats.reset();
         }
-        //sleep 2 ms every time
-        std::chrono::milliseconds dura(2);
-        std::this_thread::sleep_for(dura);
     }
 }
 
-int main(int argc, char **argv)
+//parameters of the odometry stage, opens the trajectory file
+void init(ros::NodeHandle& nh)
 {
-    
-    ros::init(argc, argv, "main");
-    ros::NodeHandle nh;
 
     int scan_line = 64;
     double vertical_angle = 2.0;
@@ -200,14 +245,29 @@ int main(int argc, char **argv)
     nh.getParam("/min_dis", min_dis);
     nh.getParam("/scan_line", scan_line);
     nh.getParam("/map_resolution", map_resolution);
+    int map_backend = MAP_BACKEND_FLANN; //0: point cloud + KdTreeFLANN, 1: incremental kd-tree, 2: voxel hash map
+    nh.getParam("/map_backend", map_backend);
+    int solver_mode = SOLVER_CERES; //0: new ceres problem every iteration, 1: one problem per frame, pooled cost functions, 2: gauss-newton
+    nh.getParam("/solver_mode", solver_mode);
+    double reassociation_threshold = 0.05;
+    nh.getParam("/reassociation_threshold", reassociation_threshold);
+    int num_threads = 0; //0: use hardware concurrency
+    nh.getParam("/num_threads", num_threads);
     std::string sequence;
     nh.getParam("/sequence", sequence);
     nh.getParam("/is_outputfile", is_outputfile);
     nh.getParam("/sequence_number", sequence_number);
-    
-
-    if(is_outputfile == 1)
-        outputFile.open("/home/socdsp/groundtruth_compare/data/" + sequence + "_pred.txt");
+    std::string output_dir = "/home/socdsp/groundtruth_compare/data/";
+    nh.getParam("/output_dir", output_dir);
+    if(!output_dir.empty() && output_dir.back() != '/')
+        output_dir += '/';
+
+    if(is_outputfile == 1){
+        outputFile.open(output_dir + sequence + "_pred.txt");
+        timeFile.open(output_dir + sequence + "_time.txt");
+        if(!outputFile.is_open() || !timeFile.is_open())
+            ROS_WARN("cannot write the trajectory to %s", output_dir.c_str());
+    }
 
     lidar_param.setScanPeriod(scan_period);
     lidar_param.setVerticalAngle(vertical_angle);
@@ -215,19 +275,88 @@ int main(int argc, char **argv)
     lidar_param.setMaxDistance(max_dis);
     lidar_param.setMinDistance(min_dis);
 
-    odomEstimation.init(lidar_param, map_resolution);
-    ros::Subscriber subEdgeLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_edge", 100, velodyneEdgeHandler);
-    ros::Subscriber subSurfLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_surf", 100, velodyneSurfHandler);
-    ros::Subscriber subprocessimage = nh.subscribe<sensor_msgs::Image>("/processed_image", 100, imageHandler);
+    odomEstimation.init(lidar_param, map_resolution, num_threads);
+    odomEstimation.setMapBackend(map_backend);
+    odomEstimation.setSolverMode(solver_mode);
+    odomEstimation.setReassociationThreshold(reassociation_threshold);
+}
 
+void advertise(ros::NodeHandle& nh)
+{
     pubLaserOdometry = nh.advertise<nav_msgs::Odometry>("/odom", 100);
-    std::thread odom_estimation_process{odom_estimation};
+}
 
-    ros::spin();
+//parameters, subscribers, publishers and the worker thread of the odometry stage
+//used by main() below and by the nodelet in floamNodelets.cpp
+bool setup(ros::NodeHandle& nh)
+{
+    //the stage state is namespace-global, a second setup in the same process would share it
+    if(is_setup.exchange(true)){
+        ROS_WARN("odom estimation stage is already running in this process, setup ignored");
+        return false;
+    }
+    init(nh);
+
+    //bounded inputs, 0: drop oldest, 1: block the subscriber, 2: keep latest, 3: skip new messages when full
+    int queue_capacity = 100;
+    int queue_policy = QUEUE_DROP_OLDEST;
+    nh.getParam("/queue_capacity", queue_capacity);
+    nh.getParam("/queue_policy", queue_policy);
+    if(queue_capacity < 1)
+        queue_capacity = 1;
+    pointCloudEdgeBuf.setCapacity(queue_capacity, (QueuePolicy)queue_policy);
+    pointCloudSurfBuf.setCapacity(queue_capacity, (QueuePolicy)queue_policy);
+    imageBuf.setCapacity(queue_capacity, (QueuePolicy)queue_policy);
+
+    queueDiagnostics.init(nh, "odom estimation");
+    diagnosticsTimer = nh.createTimer(ros::Duration(1.0), publishDiagnostics);
+
+    subEdgeLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_edge", 100, velodyneEdgeHandler);
+    subSurfLaserCloud = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_surf", 100, velodyneSurfHandler);
+    subprocessimage = nh.subscribe<sensor_msgs::Image>("/processed_image", 100, imageHandler);
+
+    advertise(nh);
+    odom_estimation_process = std::thread(odom_estimation);
+    return true;
+}
 
-    if(is_outputfile == 1)
-        outputFile.close();
+//close the input queues, the worker stops at the first queue found empty and is joined
+void shutdown()
+{
+    diagnosticsTimer.stop();
+    pointCloudEdgeBuf.close();
+    pointCloudSurfBuf.close();
+    imageBuf.close();
+    subEdgeLaserCloud.shutdown();
+    subSurfLaserCloud.shutdown();
+    subprocessimage.shutdown();
+    if(odom_estimation_process.joinable())
+        odom_estimation_process.join();
+}
+
+} // namespace odom_estimation_node
+
+#ifndef FLOAM_NO_MAIN
+int main(int argc, char **argv)
+{
+    
+    ros::init(argc, argv, "main");
+    ros::NodeHandle nh;
+
+    odom_estimation_node::setup(nh);
+
+    //one thread per input plus the diagnostics timer, with QUEUE_BLOCK a callback waiting on a full queue must not hold back the other two
+    ros::MultiThreadedSpinner spinner(4);
+    spinner.spin();
+
+    //the worker writes the trajectory, stop it before the files are closed
+    odom_estimation_node::shutdown();
+    if(odom_estimation_node::is_outputfile == 1){
+        odom_estimation_node::outputFile.close();
+        odom_estimation_node::timeFile.close();
+    }
     
     return 0;
 }
+#endif
 
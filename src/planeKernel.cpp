@@ -0,0 +1,426 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "planeKernel.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+bool makePlaneKernelParams(int half_window_size, double depth_threshold, double gradient_threshold,
+                           int intensity_threshold, PlaneKernelParams& params){
+    if(half_window_size < 0 || depth_threshold < 0 || gradient_threshold < 0 || intensity_threshold < 0)
+        return false;
+    //all differences are integers in [0, 255], so d <= t is d <= floor(t)
+    params.half_window_size = half_window_size;
+    params.intensity_half_window = half_window_size / 3;
+    params.depth_threshold = (int)std::min(255.0, std::floor(depth_threshold));
+    params.gradient_threshold = (int)std::min(255.0, std::floor(gradient_threshold));
+    params.intensity_threshold = std::min(255, intensity_threshold);
+    return true;
+}
+
+bool planeKernelPixel(const unsigned char* depth, size_t depth_step,
+                      const unsigned char* gray, size_t gray_step,
+                      int x, int y, const PlaneKernelParams& params){
+    const int h = params.half_window_size;
+    const unsigned char* row = depth + y * depth_step;
+    int c = row[x];
+    if(c == 0)
+        return false;
+
+    //x window flat and symmetric gradient along y
+    int min_pixel = 255;
+    int max_pixel = 0;
+    for(int wx = -h; wx <= h; wx++){
+        int p = row[x + wx];
+        if(p != 0){
+            min_pixel = std::min(min_pixel, p);
+            max_pixel = std::max(max_pixel, p);
+        }
+    }
+    if(max_pixel - min_pixel <= params.depth_threshold){
+        int top = depth[(y + h) * depth_step + x];
+        int down = depth[(y - h) * depth_step + x];
+        if(std::abs(std::abs(top - c) - std::abs(down - c)) <= params.gradient_threshold)
+            return true;
+    }
+
+    //y window flat and symmetric gradient along x
+    min_pixel = 255;
+    max_pixel = 0;
+    for(int wy = -h; wy <= h; wy++){
+        int p = depth[(y + wy) * depth_step + x];
+        if(p != 0){
+            min_pixel = std::min(min_pixel, p);
+            max_pixel = std::max(max_pixel, p);
+        }
+    }
+    if(max_pixel - min_pixel <= params.depth_threshold){
+        int left = row[x + h];
+        int right = row[x - h];
+        return std::abs(std::abs(left - c) - std::abs(right - c)) <= params.gradient_threshold;
+    }
+
+    //depth is not flat, fall back to a uniform intensity patch
+    const int hi = params.intensity_half_window;
+    int reference = gray[y * gray_step + x - h];
+    for(int wy = -hi; wy <= hi; wy++){
+        const unsigned char* gray_row = gray + (y + wy) * gray_step;
+        for(int wx = -hi; wx <= hi; wx++){
+            if(std::abs(gray_row[x + wx] - reference) > params.intensity_threshold)
+                return false;
+        }
+    }
+    return true;
+}
+
+int planeKernelRowScalar(const unsigned char* depth, size_t depth_step,
+                         const unsigned char* gray, size_t gray_step,
+                         int cols, int y, const PlaneKernelParams& params, int* plane_x){
+    int count = 0;
+    for(int x = params.half_window_size; x < cols - params.half_window_size; x++){
+        if(planeKernelPixel(depth, depth_step, gray, gray_step, x, y, params))
+            plane_x[count++] = x;
+    }
+    return count;
+}
+
+#if defined(__AVX2__)
+
+static inline __m256i absDiff256(__m256i a, __m256i b){
+    return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+}
+
+static inline __m256i lessEqual256(__m256i a, __m256i t){
+    return _mm256_cmpeq_epi8(_mm256_subs_epu8(a, t), _mm256_setzero_si256());
+}
+
+//32 pixels starting at x, returns the plane bit mask
+static inline unsigned int planeMask256(const unsigned char* depth, size_t depth_step,
+                                        const unsigned char* gray, size_t gray_step,
+                                        int x, int y, const PlaneKernelParams& params){
+    const int h = params.half_window_size;
+    const int hi = params.intensity_half_window;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i depth_threshold = _mm256_set1_epi8((char)params.depth_threshold);
+    const __m256i gradient_threshold = _mm256_set1_epi8((char)params.gradient_threshold);
+    const __m256i intensity_threshold = _mm256_set1_epi8((char)params.intensity_threshold);
+    const unsigned char* row = depth + y * depth_step + x;
+
+    __m256i c = _mm256_loadu_si256((const __m256i*)row);
+    __m256i non_zero = _mm256_xor_si256(_mm256_cmpeq_epi8(c, zero), _mm256_set1_epi8(-1));
+    if(_mm256_movemask_epi8(non_zero) == 0)
+        return 0;
+
+    //zero pixels are ignored: 255 for the min, 0 already is neutral for the max
+    __m256i min_x = _mm256_set1_epi8(-1);
+    __m256i max_x = zero;
+    for(int wx = -h; wx <= h; wx++){
+        __m256i p = _mm256_loadu_si256((const __m256i*)(row + wx));
+        min_x = _mm256_min_epu8(min_x, _mm256_or_si256(p, _mm256_cmpeq_epi8(p, zero)));
+        max_x = _mm256_max_epu8(max_x, p);
+    }
+    __m256i min_y = _mm256_set1_epi8(-1);
+    __m256i max_y = zero;
+    for(int wy = -h; wy <= h; wy++){
+        __m256i p = _mm256_loadu_si256((const __m256i*)(row + wy * (long)depth_step));
+        min_y = _mm256_min_epu8(min_y, _mm256_or_si256(p, _mm256_cmpeq_epi8(p, zero)));
+        max_y = _mm256_max_epu8(max_y, p);
+    }
+    //an all zero window gives max < min, the saturated difference is 0 like the scalar -255
+    __m256i flat_x = lessEqual256(_mm256_subs_epu8(max_x, min_x), depth_threshold);
+    __m256i flat_y = lessEqual256(_mm256_subs_epu8(max_y, min_y), depth_threshold);
+
+    __m256i top = _mm256_loadu_si256((const __m256i*)(row + h * (long)depth_step));
+    __m256i down = _mm256_loadu_si256((const __m256i*)(row - h * (long)depth_step));
+    __m256i gradient_y = lessEqual256(absDiff256(absDiff256(top, c), absDiff256(down, c)), gradient_threshold);
+    __m256i left = _mm256_loadu_si256((const __m256i*)(row + h));
+    __m256i right = _mm256_loadu_si256((const __m256i*)(row - h));
+    __m256i gradient_x = lessEqual256(absDiff256(absDiff256(left, c), absDiff256(right, c)), gradient_threshold);
+
+    const unsigned char* gray_center = gray + y * gray_step + x;
+    __m256i reference = _mm256_loadu_si256((const __m256i*)(gray_center - h));
+    __m256i same_intensity = _mm256_set1_epi8(-1);
+    for(int wy = -hi; wy <= hi; wy++){
+        for(int wx = -hi; wx <= hi; wx++){
+            __m256i g = _mm256_loadu_si256((const __m256i*)(gray_center + wy * (long)gray_step + wx));
+            same_intensity = _mm256_and_si256(same_intensity, lessEqual256(absDiff256(g, reference), intensity_threshold));
+        }
+    }
+
+    __m256i pass_x = _mm256_and_si256(flat_x, gradient_y);
+    __m256i pass_y = _mm256_or_si256(_mm256_and_si256(flat_y, gradient_x), _mm256_andnot_si256(flat_y, same_intensity));
+    __m256i plane = _mm256_and_si256(non_zero, _mm256_or_si256(pass_x, pass_y));
+    return (unsigned int)_mm256_movemask_epi8(plane);
+}
+
+#endif
+
+#if defined(__SSE2__)
+
+static inline __m128i absDiff128(__m128i a, __m128i b){
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+static inline __m128i lessEqual128(__m128i a, __m128i t){
+    return _mm_cmpeq_epi8(_mm_subs_epu8(a, t), _mm_setzero_si128());
+}
+
+//16 pixels starting at x, returns the plane bit mask
+static inline unsigned int planeMask128(const unsigned char* depth, size_t depth_step,
+                                        const unsigned char* gray, size_t gray_step,
+                                        int x, int y, const PlaneKernelParams& params){
+    const int h = params.half_window_size;
+    const int hi = params.intensity_half_window;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i depth_threshold = _mm_set1_epi8((char)params.depth_threshold);
+    const __m128i gradient_threshold = _mm_set1_epi8((char)params.gradient_threshold);
+    const __m128i intensity_threshold = _mm_set1_epi8((char)params.intensity_threshold);
+    const unsigned char* row = depth + y * depth_step + x;
+
+    __m128i c = _mm_loadu_si128((const __m128i*)row);
+    __m128i non_zero = _mm_xor_si128(_mm_cmpeq_epi8(c, zero), _mm_set1_epi8(-1));
+    if(_mm_movemask_epi8(non_zero) == 0)
+        return 0;
+
+    //zero pixels are ignored: 255 for the min, 0 already is neutral for the max
+    __m128i min_x = _mm_set1_epi8(-1);
+    __m128i max_x = zero;
+    for(int wx = -h; wx <= h; wx++){
+        __m128i p = _mm_loadu_si128((const __m128i*)(row + wx));
+        min_x = _mm_min_epu8(min_x, _mm_or_si128(p, _mm_cmpeq_epi8(p, zero)));
+        max_x = _mm_max_epu8(max_x, p);
+    }
+    __m128i min_y = _mm_set1_epi8(-1);
+    __m128i max_y = zero;
+    for(int wy = -h; wy <= h; wy++){
+        __m128i p = _mm_loadu_si128((const __m128i*)(row + wy * (long)depth_step));
+        min_y = _mm_min_epu8(min_y, _mm_or_si128(p, _mm_cmpeq_epi8(p, zero)));
+        max_y = _mm_max_epu8(max_y, p);
+    }
+    //an all zero window gives max < min, the saturated difference is 0 like the scalar -255
+    __m128i flat_x = lessEqual128(_mm_subs_epu8(max_x, min_x), depth_threshold);
+    __m128i flat_y = lessEqual128(_mm_subs_epu8(max_y, min_y), depth_threshold);
+
+    __m128i top = _mm_loadu_si128((const __m128i*)(row + h * (long)depth_step));
+    __m128i down = _mm_loadu_si128((const __m128i*)(row - h * (long)depth_step));
+    __m128i gradient_y = lessEqual128(absDiff128(absDiff128(top, c), absDiff128(down, c)), gradient_threshold);
+    __m128i left = _mm_loadu_si128((const __m128i*)(row + h));
+    __m128i right = _mm_loadu_si128((const __m128i*)(row - h));
+    __m128i gradient_x = lessEqual128(absDiff128(absDiff128(left, c), absDiff128(right, c)), gradient_threshold);
+
+    const unsigned char* gray_center = gray + y * gray_step + x;
+    __m128i reference = _mm_loadu_si128((const __m128i*)(gray_center - h));
+    __m128i same_intensity = _mm_set1_epi8(-1);
+    for(int wy = -hi; wy <= hi; wy++){
+        for(int wx = -hi; wx <= hi; wx++){
+            __m128i g = _mm_loadu_si128((const __m128i*)(gray_center + wy * (long)gray_step + wx));
+            same_intensity = _mm_and_si128(same_intensity, lessEqual128(absDiff128(g, reference), intensity_threshold));
+        }
+    }
+
+    __m128i pass_x = _mm_and_si128(flat_x, gradient_y);
+    __m128i pass_y = _mm_or_si128(_mm_and_si128(flat_y, gradient_x), _mm_andnot_si128(flat_y, same_intensity));
+    __m128i plane = _mm_and_si128(non_zero, _mm_or_si128(pass_x, pass_y));
+    return (unsigned int)_mm_movemask_epi8(plane);
+}
+
+#endif
+
+static inline int appendMask(unsigned int mask, int x, int* plane_x, int count){
+    while(mask != 0){
+        plane_x[count++] = x + __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+    return count;
+}
+
+int planeKernelRow(const unsigned char* depth, size_t depth_step,
+                   const unsigned char* gray, size_t gray_step,
+                   int cols, int y, const PlaneKernelParams& params, int* plane_x){
+    const int h = params.half_window_size;
+    const int x_end = cols - h;
+    int count = 0;
+    int x = h;
+#if defined(__AVX2__)
+    //loads reach x + 31 + h, which has to stay below cols
+    for(; x + 32 <= x_end; x += 32){
+        count = appendMask(planeMask256(depth, depth_step, gray, gray_step, x, y, params), x, plane_x, count);
+    }
+#endif
+#if defined(__SSE2__)
+    for(; x + 16 <= x_end; x += 16){
+        count = appendMask(planeMask128(depth, depth_step, gray, gray_step, x, y, params), x, plane_x, count);
+    }
+#endif
+    for(; x < x_end; x++){
+        if(planeKernelPixel(depth, depth_step, gray, gray_step, x, y, params))
+            plane_x[count++] = x;
+    }
+    return count;
+}
+
+void windowMinMaxX(const unsigned char* depth, size_t depth_step, int cols, int row_begin, int row_end, int h,
+                   unsigned char* min_x, unsigned char* max_x, size_t out_step){
+    const int w = 2 * h + 1;
+    if(cols < w)
+        return;
+    //prefix (from the block start) and suffix (to the block end) extrema in blocks of w
+    thread_local std::vector<unsigned char> prefix_min, prefix_max, suffix_min, suffix_max;
+    if((int)prefix_min.size() < cols){
+        prefix_min.resize(cols);
+        prefix_max.resize(cols);
+        suffix_min.resize(cols);
+        suffix_max.resize(cols);
+    }
+
+    for(int y = row_begin; y < row_end; y++){
+        const unsigned char* row = depth + y * depth_step;
+        for(int block = 0; block < cols; block += w){
+            int block_end = std::min(block + w, cols);
+            prefix_min[block] = row[block] == 0 ? 255 : row[block];
+            prefix_max[block] = row[block];
+            for(int x = block + 1; x < block_end; x++){
+                prefix_min[x] = std::min(prefix_min[x - 1], (unsigned char)(row[x] == 0 ? 255 : row[x]));
+                prefix_max[x] = std::max(prefix_max[x - 1], row[x]);
+            }
+            suffix_min[block_end - 1] = row[block_end - 1] == 0 ? 255 : row[block_end - 1];
+            suffix_max[block_end - 1] = row[block_end - 1];
+            for(int x = block_end - 2; x >= block; x--){
+                suffix_min[x] = std::min(suffix_min[x + 1], (unsigned char)(row[x] == 0 ? 255 : row[x]));
+                suffix_max[x] = std::max(suffix_max[x + 1], row[x]);
+            }
+        }
+        //[x - h, x + h] covers the tail of one block and the head of the next
+        unsigned char* out_min = min_x + y * out_step;
+        unsigned char* out_max = max_x + y * out_step;
+        for(int x = h; x < cols - h; x++){
+            out_min[x] = std::min(suffix_min[x - h], prefix_min[x + h]);
+            out_max[x] = std::max(suffix_max[x - h], prefix_max[x + h]);
+        }
+    }
+}
+
+void windowMinMaxY(const unsigned char* depth, size_t depth_step, int cols, int row_begin, int row_end, int h,
+                   unsigned char* min_y, unsigned char* max_y, size_t out_step){
+    const int w = 2 * h + 1;
+    const int rows = row_end - row_begin;
+    if(rows < w)
+        return;
+    //whole rows at a time so every pass walks memory linearly
+    thread_local std::vector<unsigned char> prefix_min, prefix_max, suffix_min, suffix_max;
+    size_t area = (size_t)rows * cols;
+    if(prefix_min.size() < area){
+        prefix_min.resize(area);
+        prefix_max.resize(area);
+        suffix_min.resize(area);
+        suffix_max.resize(area);
+    }
+
+    for(int j = 0; j < rows; j++){
+        const unsigned char* row = depth + (row_begin + j) * depth_step;
+        unsigned char* g_min = &prefix_min[(size_t)j * cols];
+        unsigned char* g_max = &prefix_max[(size_t)j * cols];
+        if(j % w == 0){
+            for(int x = 0; x < cols; x++){
+                g_min[x] = row[x] == 0 ? 255 : row[x];
+                g_max[x] = row[x];
+            }
+        }else{
+            const unsigned char* last_min = g_min - cols;
+            const unsigned char* last_max = g_max - cols;
+            for(int x = 0; x < cols; x++){
+                g_min[x] = std::min(last_min[x], (unsigned char)(row[x] == 0 ? 255 : row[x]));
+                g_max[x] = std::max(last_max[x], row[x]);
+            }
+        }
+    }
+    for(int j = rows - 1; j >= 0; j--){
+        const unsigned char* row = depth + (row_begin + j) * depth_step;
+        unsigned char* s_min = &suffix_min[(size_t)j * cols];
+        unsigned char* s_max = &suffix_max[(size_t)j * cols];
+        if(j % w == w - 1 || j == rows - 1){
+            for(int x = 0; x < cols; x++){
+                s_min[x] = row[x] == 0 ? 255 : row[x];
+                s_max[x] = row[x];
+            }
+        }else{
+            const unsigned char* next_min = s_min + cols;
+            const unsigned char* next_max = s_max + cols;
+            for(int x = 0; x < cols; x++){
+                s_min[x] = std::min(next_min[x], (unsigned char)(row[x] == 0 ? 255 : row[x]));
+                s_max[x] = std::max(next_max[x], row[x]);
+            }
+        }
+    }
+    for(int j = h; j < rows - h; j++){
+        const unsigned char* s_min = &suffix_min[(size_t)(j - h) * cols];
+        const unsigned char* s_max = &suffix_max[(size_t)(j - h) * cols];
+        const unsigned char* g_min = &prefix_min[(size_t)(j + h) * cols];
+        const unsigned char* g_max = &prefix_max[(size_t)(j + h) * cols];
+        unsigned char* out_min = min_y + (row_begin + j) * out_step;
+        unsigned char* out_max = max_y + (row_begin + j) * out_step;
+        for(int x = 0; x < cols; x++){
+            out_min[x] = std::min(s_min[x], g_min[x]);
+            out_max[x] = std::max(s_max[x], g_max[x]);
+        }
+    }
+}
+
+int planeKernelRowSeparable(const unsigned char* depth, size_t depth_step,
+                            const unsigned char* gray, size_t gray_step,
+                            const unsigned char* min_x, const unsigned char* max_x,
+                            const unsigned char* min_y, const unsigned char* max_y, size_t window_step,
+                            int cols, int y, const PlaneKernelParams& params, int* plane_x){
+    const int h = params.half_window_size;
+    const int hi = params.intensity_half_window;
+    const unsigned char* row = depth + y * depth_step;
+    const unsigned char* top_row = depth + (y + h) * depth_step;
+    const unsigned char* down_row = depth + (y - h) * depth_step;
+    const size_t offset = y * window_step;
+    int count = 0;
+
+    for(int x = h; x < cols - h; x++){
+        int c = row[x];
+        if(c == 0)
+            continue;
+
+        //windows without depth give max - min = -255 like the scalar scan
+        if(max_x[offset + x] - min_x[offset + x] <= params.depth_threshold
+           && std::abs(std::abs(top_row[x] - c) - std::abs(down_row[x] - c)) <= params.gradient_threshold){
+            plane_x[count++] = x;
+            continue;
+        }
+
+        if(max_y[offset + x] - min_y[offset + x] <= params.depth_threshold){
+            if(std::abs(std::abs(row[x + h] - c) - std::abs(row[x - h] - c)) <= params.gradient_threshold)
+                plane_x[count++] = x;
+            continue;
+        }
+
+        int reference = gray[y * gray_step + x - h];
+        bool same_intensity = true;
+        for(int wy = -hi; wy <= hi && same_intensity; wy++){
+            const unsigned char* gray_row = gray + (y + wy) * gray_step;
+            for(int wx = -hi; wx <= hi; wx++){
+                if(std::abs(gray_row[x + wx] - reference) > params.intensity_threshold){
+                    same_intensity = false;
+                    break;
+                }
+            }
+        }
+        if(same_intensity)
+            plane_x[count++] = x;
+    }
+    return count;
+}
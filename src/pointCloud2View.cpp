@@ -0,0 +1,51 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "pointCloud2View.h"
+
+namespace{
+
+int floatFieldOffset(const sensor_msgs::PointCloud2& cloud_msg, const char* name){
+    for (const sensor_msgs::PointField& field : cloud_msg.fields) {
+        if (field.name == name)
+            return field.datatype == sensor_msgs::PointField::FLOAT32 ? (int)field.offset : -1;
+    }
+    return -1;
+}
+
+}
+
+PointCloud2View::PointCloud2View(){
+    data = nullptr;
+    is_valid = false;
+    point_count = 0;
+    width = 0;
+    point_step = 0;
+    row_step = 0;
+    packed_rows = true;
+    offset_x = offset_y = offset_z = offset_intensity = -1;
+}
+
+PointCloud2View::PointCloud2View(const sensor_msgs::PointCloud2ConstPtr& cloud_msg_in) : PointCloud2View(){
+    if (!cloud_msg_in)
+        return;
+    cloud_msg = cloud_msg_in;
+    offset_x = floatFieldOffset(*cloud_msg, "x");
+    offset_y = floatFieldOffset(*cloud_msg, "y");
+    offset_z = floatFieldOffset(*cloud_msg, "z");
+    offset_intensity = floatFieldOffset(*cloud_msg, "intensity");
+    if (offset_x < 0 || offset_y < 0 || offset_z < 0)
+        return;
+    width = cloud_msg->width;
+    point_step = cloud_msg->point_step;
+    row_step = cloud_msg->row_step;
+    packed_rows = cloud_msg->height <= 1 || row_step == width * point_step;
+    point_count = width * cloud_msg->height;
+    if (cloud_msg->data.size() < (cloud_msg->height > 0 ? (cloud_msg->height - 1) * row_step + width * point_step : 0)) {
+        point_count = 0;
+        return;
+    }
+    data = cloud_msg->data.data();
+    is_valid = true;
+}
@@ -0,0 +1,55 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "queueDiagnostics.h"
+
+QueueDiagnostics::QueueDiagnostics(){
+    dropped_total = 0;
+    dropped_reported = 0;
+}
+
+void QueueDiagnostics::init(ros::NodeHandle& nh, const std::string& stage_name){
+    name = "floam " + stage_name + ": input queues";
+    pub_diagnostics = nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+}
+
+void QueueDiagnostics::addQueue(const std::string& queue_name, size_t size, size_t capacity, QueuePolicy policy, unsigned long dropped){
+    static const char* policy_names[] = {"drop oldest", "block", "keep latest", "skip"};
+    addValue(queue_name + " size", std::to_string(size));
+    addValue(queue_name + " capacity", std::to_string(capacity));
+    addValue(queue_name + " policy", policy >= QUEUE_DROP_OLDEST && policy <= QUEUE_SKIP ? policy_names[policy] : "unknown");
+    addValue(queue_name + " dropped", std::to_string(dropped));
+    dropped_total += dropped;
+}
+
+void QueueDiagnostics::publish(){
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = name;
+    status.hardware_id = "floam";
+    unsigned long dropped_new = dropped_total - dropped_reported;
+    if(dropped_new > 0){
+        status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status.message = std::to_string(dropped_new) + " messages dropped since the last report";
+    }else{
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = "no messages dropped";
+    }
+    status.values.swap(values);
+
+    diagnostic_msgs::DiagnosticArrayPtr diagnostics(new diagnostic_msgs::DiagnosticArray());
+    diagnostics->header.stamp = ros::Time::now();
+    diagnostics->status.push_back(status);
+    pub_diagnostics.publish(diagnostics);
+
+    values.clear();
+    dropped_reported = dropped_total;
+    dropped_total = 0;
+}
+
+void QueueDiagnostics::addValue(const std::string& key, const std::string& value){
+    diagnostic_msgs::KeyValue key_value;
+    key_value.key = key;
+    key_value.value = value;
+    values.push_back(key_value);
+}
@@ -0,0 +1,95 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "rangeImage.h"
+
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <string>
+
+namespace{
+
+const sensor_msgs::PointField* findField(const sensor_msgs::PointCloud2& cloud_msg, const std::string& name){
+    for (const sensor_msgs::PointField& field : cloud_msg.fields) {
+        if (field.name == name)
+            return &field;
+    }
+    return nullptr;
+}
+
+inline int readInt(const uint8_t* data, int datatype){
+    if (datatype == sensor_msgs::PointField::UINT8)
+        return *data;
+    if (datatype == sensor_msgs::PointField::UINT16) {
+        uint16_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    if (datatype == sensor_msgs::PointField::INT16) {
+        int16_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+    int32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+}
+
+RangeImage::RangeImage(){
+    rows = 0;
+    cols = 0;
+}
+
+void RangeImage::init(int rows_in, int cols_in){
+    rows = rows_in;
+    cols = cols_in;
+    cells.assign((size_t)rows * cols, pcl::PointXYZI());
+    valid.assign((size_t)rows * cols, 0);
+}
+
+bool RangeImage::fill(const PointCloud2View& cloud_view, const lidar::Lidar& lidar_param, bool use_ring_field){
+    std::fill(valid.begin(), valid.end(), 0);
+    if (!cloud_view.valid())
+        return false;
+
+    const sensor_msgs::PointCloud2& cloud_msg = cloud_view.message();
+    const sensor_msgs::PointField* field_ring = use_ring_field ? findField(cloud_msg, "ring") : nullptr;
+    if (field_ring != nullptr && (field_ring->datatype == sensor_msgs::PointField::INT8
+        || field_ring->datatype == sensor_msgs::PointField::FLOAT32 || field_ring->datatype == sensor_msgs::PointField::FLOAT64))
+        field_ring = nullptr;
+
+    double column_scale = cols / (2 * M_PI);
+    size_t width = cloud_msg.width;
+    for (size_t i = 0; i < cloud_view.size(); i++) {
+        pcl::PointXYZI point = cloud_view.point(i);
+
+        double distance = sqrt(point.x * point.x + point.y * point.y);
+        //NaN的點距離比較都是false
+        if (!(distance >= lidar_param.min_distance && distance <= lidar_param.max_distance))
+            continue;
+        int ring;
+        if (field_ring != nullptr) {
+            const uint8_t* data = cloud_msg.data.data() + (i / width) * cloud_msg.row_step + (i % width) * cloud_msg.point_step;
+            ring = readInt(data + field_ring->offset, field_ring->datatype);
+        } else {
+            ring = lidar_param.ringFromTan(point.z / distance);
+        }
+        if (ring < 0 || ring >= rows)
+            continue;
+
+        int column = (int)((atan2(point.y, point.x) + M_PI) * column_scale);
+        if (column >= cols)
+            column = cols - 1;
+        size_t index = (size_t)ring * cols + column;
+        if (valid[index])
+            continue;
+        valid[index] = 1;
+        cells[index] = point;
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "stageStats.h"
+
+//c++ lib
+#include <cstdio>
+#include <algorithm>
+
+//upper bounds of the latency buckets in ms, the last bucket takes everything above
+static const double bucket_bounds[StageStats::num_buckets - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500};
+
+StageStats::StageStats(){
+    reset();
+}
+
+void StageStats::addFrame(size_t queue_depth, double wait_ms, double process_ms){
+    frame_count++;
+    depth_sum += queue_depth;
+    depth_max = std::max(depth_max, queue_depth);
+    wait_sum += wait_ms;
+    wait_max = std::max(wait_max, wait_ms);
+    process_sum += process_ms;
+    process_max = std::max(process_max, process_ms);
+
+    double latency_ms = wait_ms + process_ms;
+    int bucket = 0;
+    while(bucket < num_buckets - 1 && latency_ms >= bucket_bounds[bucket])
+        bucket++;
+    latency_buckets[bucket]++;
+}
+
+int StageStats::frames() const{
+    return frame_count;
+}
+
+std::string StageStats::summary() const{
+    if(frame_count == 0)
+        return "no frames";
+    char line[256];
+    snprintf(line, sizeof(line), "%d frames, queue depth mean %.2f max %zu, wait mean %.2f max %.2f ms, process mean %.2f max %.2f ms, latency mean %.2f ms",
+             frame_count, depth_sum / frame_count, depth_max, wait_sum / frame_count, wait_max,
+             process_sum / frame_count, process_max, (wait_sum + process_sum) / frame_count);
+    return std::string(line);
+}
+
+std::string StageStats::histogram() const{
+    std::string text;
+    char bucket_text[64];
+    for(int i = 0; i < num_buckets; i++){
+        if(i == 0)
+            snprintf(bucket_text, sizeof(bucket_text), "<%gms:%d", bucket_bounds[0], latency_buckets[0]);
+        else if(i == num_buckets - 1)
+            snprintf(bucket_text, sizeof(bucket_text), " >%gms:%d", bucket_bounds[i - 1], latency_buckets[i]);
+        else
+            snprintf(bucket_text, sizeof(bucket_text), " %g-%gms:%d", bucket_bounds[i - 1], bucket_bounds[i], latency_buckets[i]);
+        text += bucket_text;
+    }
+    return text;
+}
+
+double StageStats::elapsedMs(const std::chrono::steady_clock::time_point& start, const std::chrono::steady_clock::time_point& end){
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void StageStats::reset(){
+    frame_count = 0;
+    depth_sum = 0;
+    depth_max = 0;
+    wait_sum = 0;
+    wait_max = 0;
+    process_sum = 0;
+    process_max = 0;
+    for(int i = 0; i < num_buckets; i++)
+        latency_buckets[i] = 0;
+}
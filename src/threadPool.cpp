@@ -0,0 +1,132 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "threadPool.h"
+
+ThreadPool::ThreadPool(int num_threads){
+    if(num_threads <= 0)
+        num_threads = (int)std::thread::hardware_concurrency();
+    if(num_threads <= 0)
+        num_threads = 1;
+
+    current_task = nullptr;
+    generation = 0;
+    active_workers = 0;
+    stop = false;
+
+    //queue 0 belongs to the calling thread
+    for(int i = 0; i < num_threads; i++){
+        queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+    }
+    for(int i = 1; i < num_threads; i++){
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        stop = true;
+    }
+    start_condition.notify_all();
+    for(auto& worker : workers){
+        worker.join();
+    }
+}
+
+int ThreadPool::size() const{
+    return (int)queues.size();
+}
+
+void ThreadPool::parallelFor(int num_tasks, const std::function<void(int)>& task){
+    if(num_tasks <= 0)
+        return;
+    if(queues.size() == 1 || num_tasks == 1){
+        for(int i = 0; i < num_tasks; i++)
+            task(i);
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        //a worker woken by the previous call may still be leaving runTasks
+        done_condition.wait(lock, [this]{ return active_workers == 0; });
+
+        //contiguous blocks per queue keep neighbouring tasks on the same thread
+        int num_queues = (int)queues.size();
+        for(int q = 0; q < num_queues; q++){
+            std::lock_guard<std::mutex> queue_lock(queues[q]->mutex);
+            int begin = (int)((long)num_tasks * q / num_queues);
+            int end = (int)((long)num_tasks * (q + 1) / num_queues);
+            for(int i = begin; i < end; i++)
+                queues[q]->tasks.push_back(i);
+        }
+        current_task = &task;
+        generation++;
+    }
+    start_condition.notify_all();
+
+    runTasks(0, task);
+
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    done_condition.wait(lock, [this]{ return active_workers == 0; });
+    current_task = nullptr;
+}
+
+void ThreadPool::workerLoop(int queue_id){
+    unsigned long seen_generation = 0;
+    while(1){
+        const std::function<void(int)>* task = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            start_condition.wait(lock, [&]{ return stop || generation != seen_generation; });
+            if(stop)
+                return;
+            seen_generation = generation;
+            task = current_task;
+            active_workers++;
+        }
+
+        if(task != nullptr)
+            runTasks(queue_id, *task);
+
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            active_workers--;
+        }
+        done_condition.notify_all();
+    }
+}
+
+void ThreadPool::runTasks(int queue_id, const std::function<void(int)>& task){
+    int task_id;
+    while(popTask(queue_id, task_id)){
+        task(task_id);
+    }
+}
+
+bool ThreadPool::popTask(int queue_id, int& task_id){
+    //own queue from the front
+    {
+        TaskQueue& own = *queues[queue_id];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty()){
+            task_id = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    //steal from the back of the others
+    int num_queues = (int)queues.size();
+    for(int i = 1; i < num_queues; i++){
+        TaskQueue& other = *queues[(queue_id + i) % num_queues];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if(!other.tasks.empty()){
+            task_id = other.tasks.back();
+            other.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,175 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "voxelHashFilter.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace{
+
+//21 bits per axis, voxels 2^21 leafs apart share a key (> 600 km at 0.3 m)
+inline uint64_t voxelKey(int64_t ix, int64_t iy, int64_t iz){
+    const uint64_t mask = (1ull << 21) - 1;
+    return ((uint64_t)ix & mask) | (((uint64_t)iy & mask) << 21) | (((uint64_t)iz & mask) << 42);
+}
+
+inline size_t voxelHash(uint64_t key){
+    //splitmix64 finalizer
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return (size_t)key;
+}
+
+}
+
+VoxelHashFilter::VoxelHashFilter(){
+    inverse_leaf[0] = inverse_leaf[1] = inverse_leaf[2] = 1.0f;
+    keep_first = false;
+    current_stamp = 0;
+}
+
+void VoxelHashFilter::setLeafSize(float leaf_x, float leaf_y, float leaf_z){
+    inverse_leaf[0] = 1.0f / leaf_x;
+    inverse_leaf[1] = 1.0f / leaf_y;
+    inverse_leaf[2] = 1.0f / leaf_z;
+}
+
+void VoxelHashFilter::setKeepFirstPoint(bool keep_first_in){
+    keep_first = keep_first_in;
+}
+
+void VoxelHashFilter::setInputCloud(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& cloud_in){
+    input = cloud_in;
+}
+
+void VoxelHashFilter::prepareTable(size_t point_count){
+    //load factor at most 1/2
+    size_t capacity = 16;
+    while(capacity < point_count * 2)
+        capacity <<= 1;
+    if(table.size() < capacity){
+        table.assign(capacity, HashSlot{0, 0, 0});
+        current_stamp = 0;
+    }
+    current_stamp++;
+    if(current_stamp == 0){
+        //stamp wrapped around, old slots could look valid again
+        for(HashSlot& slot : table)
+            slot.stamp = 0;
+        current_stamp = 1;
+    }
+}
+
+void VoxelHashFilter::addPoint(const pcl::PointXYZI& point, int index){
+    if(!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+        return;
+
+    size_t mask = table.size() - 1;
+    int ix = (int)std::floor(point.x * inverse_leaf[0]);
+    int iy = (int)std::floor(point.y * inverse_leaf[1]);
+    int iz = (int)std::floor(point.z * inverse_leaf[2]);
+    uint64_t key = voxelKey(ix, iy, iz);
+    size_t slot_id = voxelHash(key) & mask;
+    while(table[slot_id].stamp == current_stamp && table[slot_id].key != key)
+        slot_id = (slot_id + 1) & mask;
+
+    HashSlot& slot = table[slot_id];
+    if(slot.stamp != current_stamp){
+        slot.stamp = current_stamp;
+        slot.key = key;
+        slot.voxel = (int)voxels.size();
+        voxels.push_back(VoxelSum{point.x, point.y, point.z, point.intensity, 1, index, ix, iy, iz});
+    }else if(!keep_first){
+        VoxelSum& voxel = voxels[slot.voxel];
+        voxel.x += point.x;
+        voxel.y += point.y;
+        voxel.z += point.z;
+        voxel.intensity += point.intensity;
+        voxel.count++;
+    }
+}
+
+void VoxelHashFilter::sortVoxels(){
+    //pcl::VoxelGrid orders the voxels by ix + iy * nx + iz * nx * ny, i.e. by z, then y, then x
+    //the slots of the table point into voxels, they are stale afterwards but only used within one call
+    std::sort(voxels.begin(), voxels.end(), [](const VoxelSum& a, const VoxelSum& b){
+        if(a.iz != b.iz)
+            return a.iz < b.iz;
+        if(a.iy != b.iy)
+            return a.iy < b.iy;
+        return a.ix < b.ix;
+    });
+}
+
+void VoxelHashFilter::writeCentroids(pcl::PointCloud<pcl::PointXYZI>& pc_out){
+    pc_out.points.resize(voxels.size());
+    for(size_t i = 0; i < voxels.size(); i++){
+        const VoxelSum& voxel = voxels[i];
+        double scale = 1.0 / voxel.count;
+        pcl::PointXYZI& point = pc_out.points[i];
+        point.x = voxel.x * scale;
+        point.y = voxel.y * scale;
+        point.z = voxel.z * scale;
+        point.intensity = voxel.intensity * scale;
+    }
+    pc_out.width = (uint32_t)voxels.size();
+    pc_out.height = 1;
+    pc_out.is_dense = true;
+}
+
+void VoxelHashFilter::filter(pcl::PointCloud<pcl::PointXYZI>& pc_out){
+    //keep the input alive and readable while pc_out is rewritten, it may be the same cloud
+    pcl::PointCloud<pcl::PointXYZI>::ConstPtr cloud = input;
+    if(!cloud){
+        pc_out.clear();
+        return;
+    }
+
+    const std::vector<pcl::PointXYZI, Eigen::aligned_allocator<pcl::PointXYZI>>& points = cloud->points;
+    size_t point_count = points.size();
+    prepareTable(point_count);
+    voxels.clear();
+    for(size_t i = 0; i < point_count; i++)
+        addPoint(points[i], (int)i);
+    sortVoxels();
+
+    //every input point has been read, now pc_out can be written
+    pc_out.header = cloud->header;
+    if(keep_first){
+        //the input may be pc_out, the kept points go through a buffer
+        kept_points.resize(voxels.size());
+        for(size_t i = 0; i < voxels.size(); i++)
+            kept_points[i] = points[voxels[i].first];
+        pc_out.points.assign(kept_points.begin(), kept_points.end());
+        pc_out.width = (uint32_t)voxels.size();
+        pc_out.height = 1;
+        pc_out.is_dense = true;
+    }else{
+        writeCentroids(pc_out);
+    }
+}
+
+void VoxelHashFilter::filter(const PointCloud2View& view_in, pcl::PointCloud<pcl::PointXYZI>& pc_out){
+    size_t point_count = view_in.size();
+    prepareTable(point_count);
+    voxels.clear();
+    for(size_t i = 0; i < point_count; i++)
+        addPoint(view_in.point(i), (int)i);
+    sortVoxels();
+
+    if(keep_first){
+        pc_out.points.resize(voxels.size());
+        for(size_t i = 0; i < voxels.size(); i++)
+            pc_out.points[i] = view_in.point(voxels[i].first);
+        pc_out.width = (uint32_t)voxels.size();
+        pc_out.height = 1;
+        pc_out.is_dense = true;
+    }else{
+        writeCentroids(pc_out);
+    }
+}
@@ -0,0 +1,165 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+#include "voxelHashMap.h"
+
+//c++ lib
+#include <cmath>
+#include <algorithm>
+
+//21 bits per axis as VoxelHashFilter, voxels 2^21 apart share a key (> 2000 km at 1 m)
+static inline uint64_t voxelKey(int ix, int iy, int iz){
+    const uint64_t mask = (1ull << 21) - 1;
+    return ((uint64_t)ix & mask) | (((uint64_t)iy & mask) << 21) | (((uint64_t)iz & mask) << 42);
+}
+
+size_t VoxelHashMap::VoxelKeyHash::operator()(uint64_t key) const{
+    //splitmix64 finalizer
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return (size_t)key;
+}
+
+VoxelHashMap::VoxelHashMap(){
+    setResolution(1.0f, 0.0f);
+    point_count = 0;
+}
+
+void VoxelHashMap::setResolution(float voxel_size_in, float min_distance_in){
+    voxel_size = voxel_size_in;
+    inverse_voxel_size = 1.0f / voxel_size_in;
+    min_sq_distance = min_distance_in * min_distance_in;
+}
+
+void VoxelHashMap::clear(){
+    voxels.clear();
+    point_count = 0;
+}
+
+int VoxelHashMap::size() const{
+    return point_count;
+}
+
+void VoxelHashMap::voxelIndex(float x, float y, float z, int& ix, int& iy, int& iz) const{
+    ix = (int)std::floor(x * inverse_voxel_size);
+    iy = (int)std::floor(y * inverse_voxel_size);
+    iz = (int)std::floor(z * inverse_voxel_size);
+}
+
+void VoxelHashMap::addPoints(const pcl::PointCloud<pcl::PointXYZI>& points_in){
+    for(size_t i = 0; i < points_in.points.size(); i++){
+        const pcl::PointXYZI& point = points_in.points[i];
+        int ix, iy, iz;
+        voxelIndex(point.x, point.y, point.z, ix, iy, iz);
+        Voxel& voxel = voxels[voxelKey(ix, iy, iz)];
+        if(voxel.count == 0){
+            voxel.ix = ix;
+            voxel.iy = iy;
+            voxel.iz = iz;
+        }else if(voxel.count == voxel_capacity){
+            continue;
+        }
+
+        bool too_close = false;
+        for(int j = 0; j < voxel.count; j++){
+            float dx = voxel.points[j].x - point.x;
+            float dy = voxel.points[j].y - point.y;
+            float dz = voxel.points[j].z - point.z;
+            if(dx * dx + dy * dy + dz * dz < min_sq_distance){
+                too_close = true;
+                break;
+            }
+        }
+        if(too_close)
+            continue;
+
+        MapPoint& map_point = voxel.points[voxel.count++];
+        map_point.x = point.x;
+        map_point.y = point.y;
+        map_point.z = point.z;
+        map_point.intensity = point.intensity;
+        point_count++;
+    }
+}
+
+void VoxelHashMap::cropToBox(const Eigen::Vector3f& box_min, const Eigen::Vector3f& box_max){
+    for(auto it = voxels.begin(); it != voxels.end();){
+        const Voxel& voxel = it->second;
+        float center_x = (voxel.ix + 0.5f) * voxel_size;
+        float center_y = (voxel.iy + 0.5f) * voxel_size;
+        float center_z = (voxel.iz + 0.5f) * voxel_size;
+        if(center_x < box_min.x() || center_x > box_max.x()
+           || center_y < box_min.y() || center_y > box_max.y()
+           || center_z < box_min.z() || center_z > box_max.z()){
+            point_count -= voxel.count;
+            it = voxels.erase(it);
+        }else{
+            ++it;
+        }
+    }
+}
+
+void VoxelHashMap::nearestKSearch(const pcl::PointXYZI& point, int k, std::vector<pcl::PointXYZI>& near_points, std::vector<float>& sq_dis) const{
+    near_points.clear();
+    sq_dis.clear();
+    if(k <= 0)
+        return;
+
+    //k best so far, sorted by distance (k is small, insertion beats a heap)
+    std::vector<std::pair<float, const MapPoint*>> best;
+    best.reserve(k + 1);
+    int ix, iy, iz;
+    voxelIndex(point.x, point.y, point.z, ix, iy, iz);
+    for(int dx = -1; dx <= 1; dx++){
+        for(int dy = -1; dy <= 1; dy++){
+            for(int dz = -1; dz <= 1; dz++){
+                auto it = voxels.find(voxelKey(ix + dx, iy + dy, iz + dz));
+                if(it == voxels.end())
+                    continue;
+                const Voxel& voxel = it->second;
+                for(int j = 0; j < voxel.count; j++){
+                    const MapPoint& map_point = voxel.points[j];
+                    float ex = map_point.x - point.x;
+                    float ey = map_point.y - point.y;
+                    float ez = map_point.z - point.z;
+                    float distance = ex * ex + ey * ey + ez * ez;
+                    if((int)best.size() == k && distance >= best.back().first)
+                        continue;
+                    auto position = std::upper_bound(best.begin(), best.end(), distance,
+                                                     [](float value, const std::pair<float, const MapPoint*>& item){ return value < item.first; });
+                    best.insert(position, std::make_pair(distance, &map_point));
+                    if((int)best.size() > k)
+                        best.pop_back();
+                }
+            }
+        }
+    }
+
+    for(size_t i = 0; i < best.size(); i++){
+        pcl::PointXYZI near_point;
+        near_point.x = best[i].second->x;
+        near_point.y = best[i].second->y;
+        near_point.z = best[i].second->z;
+        near_point.intensity = best[i].second->intensity;
+        near_points.push_back(near_point);
+        sq_dis.push_back(best[i].first);
+    }
+}
+
+void VoxelHashMap::getPoints(pcl::PointCloud<pcl::PointXYZI>& points_out) const{
+    for(auto it = voxels.begin(); it != voxels.end(); ++it){
+        const Voxel& voxel = it->second;
+        for(int j = 0; j < voxel.count; j++){
+            pcl::PointXYZI point;
+            point.x = voxel.points[j].x;
+            point.y = voxel.points[j].y;
+            point.z = voxel.points[j].z;
+            point.intensity = voxel.points[j].intensity;
+            points_out.push_back(point);
+        }
+    }
+}
@@ -0,0 +1,198 @@
+// Author of FLOAM: Wang Han
+// Email wh200720041@gmail.com
+// Homepage https://wanghan.pro
+
+//LaserProcessingClass::computeCurvature against the per point loop it replaced
+//the kernel keeps the float arithmetic of the loop, so ids and values must be identical (tolerance 0)
+//featureExtractionFromSector against the sort-based sector selection it replaced, the edge and surf points
+//must come out in the same sequence (pointcloudtodepth keeps the last depth written to a pixel)
+
+//c++ lib
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+//LOCAL LIB
+#include "laserProcessingClass.h"
+
+namespace{
+
+//curvature loop of featureExtraction before the SoA kernel
+void baselineCurvature(const pcl::PointCloud<pcl::PointXYZI>::Ptr& scan, std::vector<Double2d>& cloudCurvature)
+{
+    const std::vector<pcl::PointXYZI, Eigen::aligned_allocator<pcl::PointXYZI>>& p = scan->points;
+    cloudCurvature.clear();
+    for(int j = 5; j < (int)p.size() - 5; j++){
+        double diffX = p[j - 5].x + p[j - 4].x + p[j - 3].x + p[j - 2].x + p[j - 1].x - 10 * p[j].x + p[j + 1].x + p[j + 2].x + p[j + 3].x + p[j + 4].x + p[j + 5].x;
+        double diffY = p[j - 5].y + p[j - 4].y + p[j - 3].y + p[j - 2].y + p[j - 1].y - 10 * p[j].y + p[j + 1].y + p[j + 2].y + p[j + 3].y + p[j + 4].y + p[j + 5].y;
+        double diffZ = p[j - 5].z + p[j - 4].z + p[j - 3].z + p[j - 2].z + p[j - 1].z - 10 * p[j].z + p[j + 1].z + p[j + 2].z + p[j + 3].z + p[j + 4].z + p[j + 5].z;
+        cloudCurvature.push_back(Double2d(j, diffX * diffX + diffY * diffY + diffZ * diffZ));
+    }
+}
+
+//featureExtractionFromSector before the partition, one sector copied out of the scan
+void baselineSector(const pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_in, std::vector<Double2d>& cloudCurvature,
+                    pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_edge, pcl::PointCloud<pcl::PointXYZI>::Ptr& pc_out_surf)
+{
+    std::sort(cloudCurvature.begin(), cloudCurvature.end(), [](const Double2d & a, const Double2d & b)
+    {
+        return a.value < b.value;
+    });
+
+    int largestPickedNum = 0;
+    std::vector<int> picked_points;
+    for (int i = cloudCurvature.size()-1; i >= 0; i=i-1)
+    {
+        int ind = cloudCurvature[i].id;
+        if(std::find(picked_points.begin(), picked_points.end(), ind)==picked_points.end()){
+            if(cloudCurvature[i].value > 0.1){
+                largestPickedNum++;
+                picked_points.push_back(ind);
+            }
+            if (largestPickedNum <= 10 && cloudCurvature[i].value > 0.1 && std::abs(pc_in->points[ind].y) >= 0.5){
+                pc_out_edge->push_back(pc_in->points[ind]);
+            }
+            else if(cloudCurvature[i].value > 5 && std::abs(pc_in->points[ind].y) >= 0.5){
+                pc_out_edge->push_back(pc_in->points[ind]);
+                picked_points.push_back(ind);
+            }
+            else{
+                pc_out_surf->push_back(pc_in->points[ind]);
+            }
+        }
+    }
+}
+
+//one ring of a spinning lidar: walls at a noisy range with steps, so both edge and surf points show up
+pcl::PointCloud<pcl::PointXYZI>::Ptr makeRing(std::mt19937& rng, int size)
+{
+    std::uniform_real_distribution<float> noise(-0.05f, 0.05f);
+    std::uniform_real_distribution<float> range(3.0f, 60.0f);
+    std::uniform_int_distribution<int> step(0, 40);
+    pcl::PointCloud<pcl::PointXYZI>::Ptr ring(new pcl::PointCloud<pcl::PointXYZI>());
+    float distance = range(rng);
+    for(int i = 0; i < size; i++){
+        if(step(rng) == 0)
+            distance = range(rng);
+        float angle = 2.0f * (float)M_PI * i / size;
+        pcl::PointXYZI point;
+        point.x = (distance + noise(rng)) * std::cos(angle);
+        point.y = (distance + noise(rng)) * std::sin(angle);
+        point.z = -1.7f + noise(rng);
+        point.intensity = 0;
+        ring->push_back(point);
+    }
+    return ring;
+}
+
+//a flat wall of evenly spaced points, most curvatures are exactly equal so the order of ties is compared as well
+pcl::PointCloud<pcl::PointXYZI>::Ptr makeWall(int size)
+{
+    pcl::PointCloud<pcl::PointXYZI>::Ptr wall(new pcl::PointCloud<pcl::PointXYZI>());
+    for(int i = 0; i < size; i++){
+        pcl::PointXYZI point;
+        point.x = 10.0f;
+        point.y = -20.0f + 0.25f * (i % 160);
+        point.z = -1.0f;
+        point.intensity = 0;
+        wall->push_back(point);
+    }
+    return wall;
+}
+
+//the 6 sectors of featureExtraction, once with featureExtractionFromSector and once with baselineSector
+void classify(LaserProcessingClass& laserProcessing, const pcl::PointCloud<pcl::PointXYZI>::Ptr& ring, std::vector<Double2d> cloudCurvature,
+              pcl::PointCloud<pcl::PointXYZI>::Ptr& edge, pcl::PointCloud<pcl::PointXYZI>::Ptr& surf,
+              pcl::PointCloud<pcl::PointXYZI>::Ptr& baseline_edge, pcl::PointCloud<pcl::PointXYZI>::Ptr& baseline_surf)
+{
+    int total_points = ring->points.size() - 10;
+    for(int j = 0; j < 6; j++){
+        int sector_length = (int)(total_points / 6);
+        int sector_start = sector_length * j;
+        int sector_end = sector_length * (j + 1) - 1;
+        if(j == 5)
+            sector_end = total_points - 1;
+        std::vector<Double2d> subCloudCurvature(cloudCurvature.begin() + sector_start, cloudCurvature.begin() + sector_end);
+        baselineSector(ring, subCloudCurvature, baseline_edge, baseline_surf);
+        laserProcessing.featureExtractionFromSector(ring, cloudCurvature, sector_start, sector_end, edge, surf);
+    }
+}
+
+void expectSamePoints(const pcl::PointCloud<pcl::PointXYZI>& expected, const pcl::PointCloud<pcl::PointXYZI>& result)
+{
+    ASSERT_EQ(expected.points.size(), result.points.size());
+    for(size_t i = 0; i < expected.points.size(); i++){
+        EXPECT_EQ(expected.points[i].x, result.points[i].x);
+        EXPECT_EQ(expected.points[i].y, result.points[i].y);
+        EXPECT_EQ(expected.points[i].z, result.points[i].z);
+    }
+}
+
+}
+
+TEST(Curvature, SameIdsAndValuesAsBaseline)
+{
+    std::mt19937 rng(7);
+    LaserProcessingClass laserProcessing;
+    ScanCurvatureBuffer buffer;
+    std::vector<Double2d> kernel;
+    std::vector<Double2d> baseline;
+    //ring sizes of 16 to 128 line sensors, the buffer is reused like in featureExtraction
+    const int sizes[] = {131, 900, 1800, 2083, 4000};
+    for(int size : sizes){
+        for(int n = 0; n < 20; n++){
+            pcl::PointCloud<pcl::PointXYZI>::Ptr ring = makeRing(rng, size);
+            laserProcessing.computeCurvature(ring, buffer, kernel);
+            baselineCurvature(ring, baseline);
+            ASSERT_EQ(baseline.size(), kernel.size());
+            for(size_t i = 0; i < baseline.size(); i++){
+                ASSERT_EQ(baseline[i].id, kernel[i].id);
+                ASSERT_EQ(baseline[i].value, kernel[i].value);
+            }
+        }
+    }
+}
+
+TEST(Curvature, ShortRingIsEmpty)
+{
+    LaserProcessingClass laserProcessing;
+    ScanCurvatureBuffer buffer;
+    std::vector<Double2d> kernel(3, Double2d(0, 0));
+    std::mt19937 rng(1);
+    laserProcessing.computeCurvature(makeRing(rng, 10), buffer, kernel);
+    EXPECT_TRUE(kernel.empty());
+}
+
+TEST(Curvature, SameEdgeAndSurfSequenceAsSortedSector)
+{
+    std::mt19937 rng(11);
+    LaserProcessingClass laserProcessing;
+    ScanCurvatureBuffer buffer;
+    int edge_total = 0;
+    for(int n = 0; n < 51; n++){
+        //the last ring is the wall full of equal curvatures
+        pcl::PointCloud<pcl::PointXYZI>::Ptr ring = n < 50 ? makeRing(rng, 1800) : makeWall(1800);
+        std::vector<Double2d> cloudCurvature;
+        laserProcessing.computeCurvature(ring, buffer, cloudCurvature);
+
+        pcl::PointCloud<pcl::PointXYZI>::Ptr edge(new pcl::PointCloud<pcl::PointXYZI>());
+        pcl::PointCloud<pcl::PointXYZI>::Ptr surf(new pcl::PointCloud<pcl::PointXYZI>());
+        pcl::PointCloud<pcl::PointXYZI>::Ptr baseline_edge(new pcl::PointCloud<pcl::PointXYZI>());
+        pcl::PointCloud<pcl::PointXYZI>::Ptr baseline_surf(new pcl::PointCloud<pcl::PointXYZI>());
+        classify(laserProcessing, ring, cloudCurvature, edge, surf, baseline_edge, baseline_surf);
+        expectSamePoints(*baseline_edge, *edge);
+        expectSamePoints(*baseline_surf, *surf);
+        edge_total += edge->points.size();
+    }
+    //the rings must exercise the edge branch, not only surf
+    EXPECT_GT(edge_total, 0);
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}